@@ -1,24 +1,141 @@
 #include "abuf.h"
+#include "trace.h"
 
+#include <errno.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#define ABUF_MIN_CAP 64
+
+// IOV_MAX is only exposed along with the XSI extensions.
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
 void
-ab_append (struct abuf *ab, const char *str, int len)
+ab_reserve (struct abuf *ab, int len)
 {
-  char *new = realloc (ab->b, ab->len + len);
+  if (ab->len + len <= ab->cap)
+    return;
+
+  // Grow geometrically so that appends are amortized O(1).
+  int cap = ab->cap ? ab->cap : ABUF_MIN_CAP;
+  while (cap < ab->len + len)
+    cap *= 2;
 
+  char *new = realloc (ab->b, cap);
   if (new == NULL)
     return;
 
-  memcpy (&new[ab->len], str, len);
   ab->b = new;
+  ab->cap = cap;
+}
+
+void
+ab_append (struct abuf *ab, const char *str, int len)
+{
+  if (len <= 0)
+    return;
+
+  ab_reserve (ab, len);
+  if (ab->len + len > ab->cap)
+    return;
+
+  memcpy (&ab->b[ab->len], str, len);
   ab->len += len;
 }
 
+void
+ab_append_repeat (struct abuf *ab, char c, int count)
+{
+  if (count <= 0)
+    return;
+
+  ab_reserve (ab, count);
+  if (ab->len + count > ab->cap)
+    return;
+
+  memset (&ab->b[ab->len], c, count);
+  ab->len += count;
+}
+
+void
+ab_appendf (struct abuf *ab, const char *fmt, ...)
+{
+  va_list ap;
+
+  // Try the spare capacity first, only grow when the text does not fit.
+  va_start (ap, fmt);
+  int len = vsnprintf (ab->b ? &ab->b[ab->len] : NULL, ab->cap - ab->len,
+                       fmt, ap);
+  va_end (ap);
+
+  if (len < 0)
+    return;
+
+  if (ab->len + len >= ab->cap)
+    {
+      ab_reserve (ab, len + 1);
+      if (ab->len + len >= ab->cap)
+        return;
+
+      va_start (ap, fmt);
+      vsnprintf (&ab->b[ab->len], ab->cap - ab->len, fmt, ap);
+      va_end (ap);
+    }
+
+  ab->len += len;
+}
+
+ssize_t
+ab_writev (int fd, struct iovec *iov, int count)
+{
+  ssize_t total = 0;
+
+  while (count > 0)
+    {
+      trace_syscall ();
+      ssize_t written = writev (fd, iov, count < IOV_MAX ? count : IOV_MAX);
+      if (written == -1)
+        {
+          if (errno == EINTR)
+            continue;
+          return -1;
+        }
+      total += written;
+
+      // Skip what was written, the last vector may be partially done.
+      while (count > 0 && (size_t)written >= iov->iov_len)
+        {
+          written -= iov->iov_len;
+          iov++;
+          count--;
+        }
+      if (count > 0)
+        {
+          iov->iov_base = (char *)iov->iov_base + written;
+          iov->iov_len -= written;
+        }
+    }
+
+  return total;
+}
+
+void
+ab_reset (struct abuf *ab)
+{
+  ab->len = 0;
+}
+
 // desctructor
 void
 ab_free (struct abuf *ab)
 {
   free (ab->b);
+  ab->b = NULL;
+  ab->len = 0;
+  ab->cap = 0;
 }
@@ -1,21 +1,42 @@
 #ifndef ABUF_H
 #define ABUF_H
 
+#include <sys/types.h>
+#include <sys/uio.h>
+
 struct abuf
 {
   char *b;
   int len;
+  int cap;
 };
 
 // constructor
 #define ABUF_INIT                                                             \
   {                                                                           \
-    NULL, 0                                                                   \
+    NULL, 0, 0                                                                \
   }
 
 // desctructor
 void ab_free (struct abuf *ab);
 
+// Empty the buffer but keep its memory around for reuse.
+void ab_reset (struct abuf *ab);
+
+// Make room for at least LEN more bytes.
+void ab_reserve (struct abuf *ab, int len);
+
 void ab_append (struct abuf *ab, const char *str, int len);
 
-#endif
\ No newline at end of file
+// Append COUNT copies of C.
+void ab_append_repeat (struct abuf *ab, char c, int count);
+
+// Append printf style formatted text.
+void ab_appendf (struct abuf *ab, const char *fmt, ...)
+    __attribute__ ((format (printf, 2, 3)));
+
+// Write all COUNT vectors to FD, retrying short writes. Returns the number
+// of bytes written or -1 on error.
+ssize_t ab_writev (int fd, struct iovec *iov, int count);
+
+#endif
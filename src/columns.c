@@ -0,0 +1,213 @@
+// feature test macros
+#define _XOPEN_SOURCE 700
+
+#include "columns.h"
+
+#include <stddef.h>
+#include <wchar.h>
+
+/***************** helpers ************************/
+
+static bool
+is_continuation (char c)
+{
+  return (c & 0xC0) == 0x80;
+}
+
+// Decode the UTF-8 sequence at TEXT into CODE, returning its length or 0 if
+// the LEN bytes left do not start with a valid one.
+static int
+decode (const char *text, int len, unsigned int *code)
+{
+  static const unsigned int min_code[] = { 0, 0, 0x80, 0x800, 0x10000 };
+  unsigned char c = text[0];
+  int length;
+
+  if (c < 0x80)
+    {
+      *code = c;
+      return 1;
+    }
+  else if ((c & 0xE0) == 0xC0)
+    {
+      length = 2;
+      *code = c & 0x1F;
+    }
+  else if ((c & 0xF0) == 0xE0)
+    {
+      length = 3;
+      *code = c & 0x0F;
+    }
+  else if ((c & 0xF8) == 0xF0)
+    {
+      length = 4;
+      *code = c & 0x07;
+    }
+  else
+    return 0;
+
+  if (length > len)
+    return 0;
+
+  for (int i = 1; i < length; i++)
+    {
+      if (!is_continuation (text[i]))
+        return 0;
+      *code = *code << 6 | (text[i] & 0x3F);
+    }
+
+  // Overlong forms, surrogates and values past Unicode are not characters.
+  if (*code < min_code[length] || *code > 0x10FFFF
+      || (*code >= 0xD800 && *code <= 0xDFFF))
+    return 0;
+
+  return length;
+}
+
+/***************** columns ************************/
+
+int
+column_char (const char *text, int len, int col, int *width)
+{
+  if (text[0] == '\t')
+    {
+      *width = TAB_SIZE - col % TAB_SIZE;
+      return 1;
+    }
+
+  unsigned int code;
+  int length = decode (text, len, &code);
+  if (length <= 1)
+    {
+      *width = 1;
+      return 1;
+    }
+
+  // Unprintable, or unknown to a locale that is not UTF-8.
+  int w = wcwidth (code);
+  *width = w < 0 ? 1 : w;
+  return length;
+}
+
+bool
+column_printable (const char *text, int length)
+{
+  unsigned char c = text[0];
+  if (length == 1)
+    return c >= ' ' && c != 0x7F && c < 0x80;
+
+  // C1 control characters.
+  return !(c == 0xC2 && (unsigned char)text[1] < 0xA0);
+}
+
+int
+column_prev_char (const char *text, int size, int at)
+{
+  if (at <= 0)
+    return 0;
+
+  // Walk back to the lead byte and check that its sequence ends at AT,
+  // otherwise the byte before AT stands on its own.
+  int start = at - 1;
+  while (start > 0 && at - start < 4 && is_continuation (text[start]))
+    start--;
+
+  unsigned int code;
+  if (decode (&text[start], size - start, &code) == at - start)
+    return start;
+  return at - 1;
+}
+
+int
+column_checkpoints (int size)
+{
+  return size > 0 ? (size - 1) / COLUMN_CHECKPOINT_BYTES : 0;
+}
+
+void
+column_index (const char *text, int size, struct column_checkpoint *index)
+{
+  int count = column_checkpoints (size);
+  int col = 0, k = 0;
+
+  for (int i = 0; i < size && k < count;)
+    {
+      int width;
+      int length = column_char (&text[i], size - i, col, &width);
+
+      // Checkpoint K is for byte (K + 1) * COLUMN_CHECKPOINT_BYTES.
+      while (k < count && i + length > (k + 1) * COLUMN_CHECKPOINT_BYTES)
+        {
+          index[k].byte = i;
+          index[k].col = col;
+          k++;
+        }
+
+      i += length;
+      col += width;
+    }
+}
+
+int
+column_of_byte (const char *text, int size,
+                const struct column_checkpoint *index, int cx)
+{
+  int i = 0, col = 0;
+
+  int k = cx / COLUMN_CHECKPOINT_BYTES;
+  if (k > column_checkpoints (size))
+    k = column_checkpoints (size);
+  if (index && k > 0)
+    {
+      i = index[k - 1].byte;
+      col = index[k - 1].col;
+    }
+
+  while (i < cx && i < size)
+    {
+      int width;
+      i += column_char (&text[i], size - i, col, &width);
+      col += width;
+    }
+
+  return col;
+}
+
+int
+column_to_byte (const char *text, int size,
+                const struct column_checkpoint *index, int rx, int *col)
+{
+  int i = 0, c = 0;
+
+  if (index)
+    {
+      // Last checkpoint at or before RX.
+      int low = 0, high = column_checkpoints (size);
+      while (low < high)
+        {
+          int mid = low + (high - low) / 2;
+          if (index[mid].col <= rx)
+            low = mid + 1;
+          else
+            high = mid;
+        }
+      if (low > 0)
+        {
+          i = index[low - 1].byte;
+          c = index[low - 1].col;
+        }
+    }
+
+  while (i < size)
+    {
+      int width;
+      int length = column_char (&text[i], size - i, c, &width);
+      if (c + width > rx)
+        break;
+      i += length;
+      c += width;
+    }
+
+  *col = c;
+  return i;
+}
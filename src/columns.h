@@ -0,0 +1,52 @@
+#ifndef COLUMNS_H
+#define COLUMNS_H
+
+#include <stdbool.h>
+
+// Mapping between the bytes of a row and the screen columns they are drawn
+// at. Text is decoded as UTF-8 and every character takes the columns the
+// terminal gives it, tabs reach up to the next tab stop, and bytes that do
+// not form a valid character count as one column each.
+
+#define TAB_SIZE 4
+
+// Rows longer than this keep checkpoints so that a column lookup only has to
+// walk the bytes after the nearest one.
+#define COLUMN_CHECKPOINT_BYTES 256
+
+// Start of the character that holds a checkpointed byte and its column.
+struct column_checkpoint
+{
+  int byte;
+  int col;
+};
+
+// Length in bytes of the character at TEXT, which has LEN bytes left, and
+// in WIDTH the columns it takes when drawn at column COL.
+int column_char (const char *text, int len, int col, int *width);
+
+// Whether the LENGTH bytes of the character at TEXT can be sent to the
+// terminal as they are, as opposed to control characters and invalid bytes.
+bool column_printable (const char *text, int length);
+
+// Start of the character before byte AT of TEXT.
+int column_prev_char (const char *text, int size, int at);
+
+// Number of checkpoints of a row of SIZE bytes.
+int column_checkpoints (int size);
+
+// Fill in the checkpoints of the SIZE bytes of TEXT.
+void column_index (const char *text, int size,
+                   struct column_checkpoint *index);
+
+// Column that byte CX of TEXT is drawn at. INDEX holds the checkpoints of
+// TEXT or is NULL to walk it from the start.
+int column_of_byte (const char *text, int size,
+                    const struct column_checkpoint *index, int cx);
+
+// Start of the character drawn at column RX of TEXT, or SIZE if the text
+// ends before, with the column the character starts at stored in COL.
+int column_to_byte (const char *text, int size,
+                    const struct column_checkpoint *index, int rx, int *col);
+
+#endif
@@ -1,73 +1,234 @@
+// feature test macros
+#define _GNU_SOURCE
+
 #include "editor.h"
+#include "file_view.h"
+#include "follow.h"
+#include "loader.h"
+#include "render_cache.h"
+#include "screen.h"
+#include "search.h"
+#include "swap.h"
+#include "syntax.h"
 #include "terminal.h"
+#include "trace.h"
+#include "undo.h"
 
 /****************** headers *************************/
 #include <assert.h>
 #include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+// The heap figure of the performance overlay comes from glibc, other C
+// libraries don't tell.
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+#include <malloc.h>
+#define HAVE_MALLINFO2
+#endif
+
+// macOS names the nanoseconds of the times in struct stat differently.
+#ifdef __APPLE__
+#define st_mtim st_mtimespec
+#endif
+
 struct editor_config E;
 
 /***************** terminal *****************************/
 
+// Keys are decoded from a buffer that every read () fills with as much
+// input as is available, instead of reading byte by byte.
+static struct
+{
+  int fd;
+  bool eof;
+  char buf[INPUT_BUFFER_SIZE];
+  int start;
+  int end;
+} input = { STDIN_FILENO, false, { 0 }, 0, 0 };
+
+// Text of the last bracketed paste, see PASTE_KEY.
+static struct abuf paste = ABUF_INIT;
+
+// Read whatever input is available, waiting up to TIMEOUT milliseconds for
+// some to arrive, or forever if TIMEOUT is -1.
+static bool
+input_fill (int timeout)
+{
+  if (input.start == input.end)
+    input.start = input.end = 0;
+
+  if (input.end == INPUT_BUFFER_SIZE)
+    return true;
+
+  struct pollfd pfd = { input.fd, POLLIN, 0 };
+  trace_syscall ();
+  int ready = poll (&pfd, 1, timeout);
+  if (ready == -1 && errno != EINTR)
+    die ("poll");
+  if (ready <= 0)
+    return false;
+
+  trace_syscall ();
+  int bytes_read = read (input.fd, &input.buf[input.end],
+                         INPUT_BUFFER_SIZE - input.end);
+  if (bytes_read == -1 && errno != EAGAIN && errno != EINTR)
+    die ("read");
+
+  // Readable but nothing to read, the input has ended.
+  if (bytes_read == 0)
+    input.eof = true;
+
+  if (bytes_read <= 0)
+    return false;
+
+  trace_input ();
+  input.end += bytes_read;
+  return true;
+}
+
+static bool
+input_getc (char *c, int timeout)
+{
+  if (input.start == input.end && !input_fill (timeout))
+    return false;
+
+  *c = input.buf[input.start++];
+  return true;
+}
+
+bool
+editor_input_pending ()
+{
+  return input.start != input.end;
+}
+
+void
+editor_set_input (int fd)
+{
+  input.fd = fd;
+  input.eof = false;
+  input.start = input.end = 0;
+}
+
+bool
+editor_input_wait (int timeout)
+{
+  return editor_input_pending () || input_fill (timeout);
+}
+
+// Collect everything up to the end of a bracketed paste into PASTE.
+static void
+editor_read_paste ()
+{
+  static const char end_marker[] = "\x1b[201~";
+  const int marker_length = sizeof (end_marker) - 1;
+
+  ab_reset (&paste);
+  while (true)
+    {
+      // Give up on a paste whose end never arrives.
+      if (input.start == input.end && !input_fill (PASTE_TIMEOUT_MS))
+        {
+          paste.len = 0;
+          return;
+        }
+
+      // The marker may straddle two reads.
+      int from = paste.len > marker_length ? paste.len - marker_length : 0;
+      int length = input.end - input.start;
+      ab_append (&paste, &input.buf[input.start], length);
+      input.start = input.end;
+
+      int marker = search_find (paste.b, paste.len, end_marker,
+                                marker_length, from);
+      if (marker != -1)
+        {
+          // Whatever follows the marker is regular input again.
+          int rest = paste.len - (marker + marker_length);
+          input.start = input.end - rest;
+          paste.len = marker;
+          return;
+        }
+    }
+}
+
 int
 editor_read_key ()
 {
   char c;
-  int charaters_read = read (STDIN_FILENO, &c, 1);
-
-  while (charaters_read != 1)
+  while (!input_getc (&c, -1))
     {
-      charaters_read = read (STDIN_FILENO, &c, 1);
-      if (charaters_read == -1)
-        die ("read");
+      // The terminal went away.
+      if (input.eof)
+        {
+          errno = EIO;
+          die ("read");
+        }
     }
 
   // read escape sequence
   if (c == '\x1b')
     {
-      char seq[3];
-      if (read (STDIN_FILENO, &seq[0], 1) != 1)
+      char seq[2];
+      if (!input_getc (&seq[0], ESC_TIMEOUT_MS))
         return '\x1b';
 
-      if (read (STDIN_FILENO, &seq[1], 1) != 1)
+      if (!input_getc (&seq[1], ESC_TIMEOUT_MS))
         return '\x1b';
 
       if (seq[0] == '[')
         {
           if (seq[1] >= '0' && seq[1] <= '9')
             {
-
-              if (read (STDIN_FILENO, &seq[2], 1) != 1)
+              // Numbered keys look like "ESC [ <number> ~".
+              int number = seq[1] - '0';
+              char next;
+              if (!input_getc (&next, ESC_TIMEOUT_MS))
                 return '\x1b';
 
-              if (seq[2] == '~')
+              while (next >= '0' && next <= '9')
+                {
+                  number = number * 10 + next - '0';
+                  if (!input_getc (&next, ESC_TIMEOUT_MS))
+                    return '\x1b';
+                }
+
+              if (next == '~')
                 {
-                  switch (seq[1])
+                  switch (number)
                     {
-                    case '1':
+                    case 1:
                       return HOME_KEY;
-                    case '3':
+                    case 3:
                       return DEL_KEY;
-                    case '4':
+                    case 4:
                       return END_KEY;
-                    case '5':
+                    case 5:
                       return PAGE_UP;
-                    case '6':
+                    case 6:
                       return PAGE_DOWN;
-                    case '7':
+                    case 7:
                       return HOME_KEY;
-                    case '8':
+                    case 8:
                       return END_KEY;
+                    case 200:
+                      editor_read_paste ();
+                      return PASTE_KEY;
                     }
                 }
             }
@@ -88,6 +249,8 @@ editor_read_key ()
                   return HOME_KEY;
                 case 'F':
                   return END_KEY;
+                case 'Z':
+                  return SHIFT_TAB;
                 }
             }
         }
@@ -111,79 +274,401 @@ editor_read_key ()
 
 /************************ row operations ********************/
 
+// Long rows get their column checkpoints built once and then looked up,
+// see columns.h
 int
 editor_convert_cx_to_rx (e_row *row, const int cx)
 {
-  int rx = 0;
+  editor_render_row (row);
+  return column_of_byte (row->text, row->size, render_cache_columns (row),
+                         cx);
+}
+
+// Byte of ROW at the start of the character drawn at column RX.
+int
+editor_convert_rx_to_cx (e_row *row, const int rx)
+{
+  int col;
+  editor_render_row (row);
+  return column_to_byte (row->text, row->size, render_cache_columns (row),
+                         rx, &col);
+}
+
+// Lex rows until the end states of the first ROWS rows are known.
+static void
+editor_syntax_advance (int rows)
+{
+  if (E.buf->syntax_rows >= rows)
+    return;
+
+  e_row *row = row_tree_at (&E.buf->rows, E.buf->syntax_rows);
+  if (row == NULL)
+    return;
+
+  e_row *prev = row_tree_prev (row);
+  enum syntax_state state = prev ? prev->hl_state : SYNTAX_NORMAL;
+
+  for (; row && E.buf->syntax_rows < rows; row = row_tree_next (row))
+    {
+      state = syntax_lex (E.buf->syntax, row->text, row->size, NULL, state);
+      row->hl_state = state;
+      E.buf->syntax_rows++;
+    }
+}
+
+// Re-lex ROW after its text or the state it starts in changed, and the rows
+// below it for as long as the state they start in changes too. Only the
+// rows lexed so far are kept up to date, the rest is lexed once drawn.
+static void
+editor_update_syntax (e_row *row)
+{
+  if (E.buf->syntax == NULL)
+    return;
+
+  int at = row_tree_index_of (row);
+  if (at >= E.buf->syntax_rows)
+    return;
+
+  e_row *prev = row_tree_prev (row);
+  enum syntax_state state = prev ? prev->hl_state : SYNTAX_NORMAL;
+
+  for (; row && at < E.buf->syntax_rows; row = row_tree_next (row), at++)
+    {
+      editor_invalidate_row (row);
+      state = syntax_lex (E.buf->syntax, row->text, row->size, NULL, state);
+      if (state == row->hl_state)
+        break;
+      row->hl_state = state;
+    }
+}
+
+// Screen lines ROW takes when wrapped at WIDTH columns. Its columns are
+// cut into lines of WIDTH, and there is room for the cursor after the end.
+static int
+editor_wrap_lines (const e_row *row, int width)
+{
+  // Only tabs take more columns than bytes.
+  if (row->size < width && memchr (row->text, '\t', row->size) == NULL)
+    return 1;
+
+  return 1
+         + column_of_byte (row->text, row->size, render_cache_columns (row),
+                           row->size)
+               / width;
+}
+
+// Take in the new size of ROW, and the lines it wraps to if they are kept.
+static void
+editor_row_resized (e_row *row)
+{
+  if (E.buf->wrap_width)
+    row->lines = editor_wrap_lines (row, E.buf->wrap_width);
+  row_tree_resized (row);
+}
+
+// Rows changed by the edit transaction in progress, see
+// editor_begin_edit ().
+static struct
+{
+  int depth;
+  e_row **rows;
+  int num_rows;
+  int capacity;
+  // The text changed, the matches of the search are dropped at commit.
+  bool changed;
+  // Index Y of the row journaled last, which is looked up again and again
+  // while it is edited. NULL once rows were inserted or deleted since.
+  const e_row *row;
+  int y;
+} edit = { 0, NULL, 0, 0, false, NULL, 0 };
+
+// The matches found so far are stale once the text changed.
+static void
+editor_text_changed ()
+{
+  if (edit.depth > 0)
+    edit.changed = true;
+  else
+    search_reset (&E.buf->search);
+}
 
-  for (int j = 0; j < cx; j++)
+// Bring what is derived from the text of ROW, its size and highlight, up
+// to date after it changed, or leave it to the commit of the transaction
+// in progress, which does it once however often the row changed.
+static void
+editor_row_changed (e_row *row)
+{
+  E.buf->modified = 1;
+  editor_text_changed ();
+  if (edit.depth == 0)
     {
-      if (row->text[j] == '\t')
-        rx += (TAB_SIZE - 1) - (rx % TAB_SIZE);
+      editor_row_resized (row);
+      editor_update_syntax (row);
+      return;
+    }
+
+  if (row->dirty)
+    return;
 
-      rx++;
+  if (edit.num_rows == edit.capacity)
+    {
+      edit.capacity = edit.capacity ? 2 * edit.capacity : 64;
+      edit.rows = realloc (edit.rows, edit.capacity * sizeof (e_row *));
+      if (edit.rows == NULL)
+        die ("realloc");
     }
+  edit.rows[edit.num_rows++] = row;
+  row->dirty = true;
+}
+
+// ROW is about to be deleted, the transaction must not come back to it.
+static void
+editor_row_deleted (e_row *row)
+{
+  if (!row->dirty)
+    return;
 
-  return rx;
+  // Rows are usually deleted soon after they changed.
+  for (int i = edit.num_rows - 1; i >= 0; i--)
+    if (edit.rows[i] == row)
+      {
+        edit.rows[i] = edit.rows[--edit.num_rows];
+        break;
+      }
+  row->dirty = false;
 }
 
 void
-editor_update_row (e_row *row)
+editor_begin_edit ()
 {
-  int tabs = 0;
-  // Find tabs and allocate required amount of memory dynamically.
-  for (int j = 0; j < row->size; j++)
-    if (row->text[j] == '\t')
-      tabs++;
+  // The transaction is an undo step of its own, it doesn't extend the edit
+  // typed before it.
+  if (edit.depth++ == 0)
+    {
+      undo_break (&E.buf->undo);
+      undo_begin_group (&E.buf->undo);
+    }
+}
 
-  free (row->renderer);
-  row->renderer = malloc (row->size + (tabs * (TAB_SIZE - 1)) + 1);
+void
+editor_commit_edit ()
+{
+  if (--edit.depth > 0)
+    return;
 
-  int idx = 0;
-  for (int j = 0; j < row->size; j++)
+  // Lexing a row may lex the dirty rows below it as well, whichever order
+  // they come in the states settle the same.
+  for (int i = 0; i < edit.num_rows; i++)
     {
-      if (row->text[j] == '\t')
-        {
-          row->renderer[idx++] = ' ';
-          while (idx % TAB_SIZE != 0)
-            row->renderer[idx++] = ' ';
-        }
-      else
-        {
-          row->renderer[idx++] = row->text[j];
-        }
+      edit.rows[i]->dirty = false;
+      editor_row_resized (edit.rows[i]);
+      editor_update_syntax (edit.rows[i]);
+    }
+  edit.num_rows = 0;
+  edit.row = NULL;
+
+  if (edit.changed)
+    search_reset (&E.buf->search);
+  edit.changed = false;
+
+  // Typing on must not extend the last edit of the transaction.
+  undo_break (&E.buf->undo);
+}
+
+// Lex the text of ROW into its highlight. ROW itself is lexed up to date as
+// well so that edits above it reach its highlight.
+static void
+editor_highlight_row (e_row *row)
+{
+  editor_syntax_advance (row_tree_index_of (row) + 1);
+
+  e_row *prev = row_tree_prev (row);
+  enum syntax_state state = prev ? prev->hl_state : SYNTAX_NORMAL;
+  syntax_lex (E.buf->syntax, row->text, row->size,
+              render_cache_highlight (row), state);
+}
+
+// Build what drawing ROW takes unless it is still cached: the highlight of
+// its bytes if the document has a syntax and the column checkpoints of a
+// long row. Rows are drawn straight from their text.
+void
+editor_render_row (e_row *row)
+{
+  if (row->cache_slot)
+    {
+      render_cache_touch (row);
+      return;
+    }
+
+  int checkpoints = column_checkpoints (row->size);
+  bool highlight = E.buf->syntax && row->size > 0;
+  if (checkpoints == 0 && !highlight)
+    return;
+
+  render_cache_alloc (row, checkpoints, highlight ? row->size : 0);
+  if (checkpoints)
+    column_index (row->text, row->size, render_cache_columns (row));
+  if (highlight)
+    editor_highlight_row (row);
+}
+
+// Drop what was derived from ROW for drawing, it has to be called before
+// TEXT changes.
+void
+editor_invalidate_row (e_row *row)
+{
+  render_cache_drop (row);
+}
+
+// Keep the screen lines of the rows counted for the width of the screen
+// while soft wrapping. They are counted over for a new width, and not kept
+// up to date at all otherwise.
+static void
+editor_wrap_update ()
+{
+  int width = 0;
+  if (E.soft_wrap)
+    width = E.screen_cols > 0 ? E.screen_cols : 1;
+  if (E.buf->wrap_width == width)
+    return;
+
+  E.buf->wrap_width = width;
+  if (width == 0)
+    return;
+
+  for (e_row *row = row_tree_at (&E.buf->rows, 0); row;
+       row = row_tree_next (row))
+    row->lines = editor_wrap_lines (row, width);
+  row_tree_refresh (&E.buf->rows);
+}
+
+// Make room in ROW for LENGTH bytes of text and the terminating NUL.
+static void
+editor_row_reserve (e_row *row, int length)
+{
+  if (length < row->capacity)
+    return;
+
+  // Leave some headroom so that typing into a row rarely moves it. Text
+  // kept behind the row moves out for good, its room goes with the row.
+  int size = length + 1 + length / 4;
+  if (row_tree_text_inline (row))
+    {
+      char *text = row_arena_alloc (&E.buf->arena, size, &row->capacity);
+      memcpy (text, row->text, row->size + 1);
+      row->text = text;
+      return;
+    }
+
+  row->text = row_arena_realloc (&E.buf->arena, row->text, row->capacity,
+                                 size, &row->capacity);
+}
+
+void
+editor_row_own (e_row *row)
+{
+  if (!row->mapped)
+    return;
+
+  int capacity;
+  char *text = row_arena_alloc (&E.buf->arena, row->size + 1, &capacity);
+  memcpy (text, row->text, row->size);
+  text[row->size] = '\0';
+
+  editor_invalidate_row (row);
+  row->text = text;
+  row->capacity = capacity;
+  row->mapped = false;
+}
+
+// Rows from Y on differ from the file as saved.
+static void
+editor_unsaved_from (int y)
+{
+  if (y < E.buf->save_from)
+    E.buf->save_from = y;
+}
+
+// Journal an edit of ROW made at X, for undo and to the swap file, and
+// take note of it for the next save. The swap file gets every edit as it
+// is made, including those that undo or redo make.
+static void
+editor_record (enum undo_kind kind, const e_row *row, int x, const char *text,
+               int len)
+{
+  bool cached = edit.depth > 0 && row == edit.row;
+  int y = cached ? edit.y : row_tree_index_of (row);
+  if (edit.depth > 0)
+    {
+      edit.row = row;
+      edit.y = y;
     }
 
-  row->renderer[idx] = '\0';
-  row->r_size = idx;
+  editor_unsaved_from (y);
+  if (!undo_recording (&E.buf->undo) && !E.buf->swap.active)
+    return;
+
+  undo_record (&E.buf->undo, kind, y, x, text, len, E.buf->cursor_y,
+               E.buf->cursor_x);
+  swap_record (&E.buf->swap, kind, y, x, text, len);
 }
 
 void
 editor_insert_row (int at, char *s, size_t len)
 {
-  if (at < 0 || at > E.num_rows)
+  if (at < 0 || at > E.buf->num_rows)
     return;
 
-  E.row = realloc (E.row, sizeof (e_row) * (E.num_rows + 1));
-  memmove (&E.row[at + 1], &E.row[at], sizeof (e_row) * (E.num_rows - at));
+  undo_record (&E.buf->undo, UNDO_INSERT_ROW, at, 0, s, len, E.buf->cursor_y,
+               E.buf->cursor_x);
+  swap_record (&E.buf->swap, UNDO_INSERT_ROW, at, 0, s, len);
+  editor_unsaved_from (at);
+
+  // Short rows keep their text right behind them.
+  e_row *row = row_tree_insert (&E.buf->rows, at, len + 1);
+  edit.row = NULL;
+
+  row->size = len;
+  if (row->text == NULL)
+    row->text = row_arena_alloc (&E.buf->arena, len + 1, &row->capacity);
+  memcpy (row->text, s, len);
+  row->text[len] = '\0';
+  editor_row_resized (row);
+
+  E.buf->num_rows++;
+  E.buf->modified = 1;
+
+  // Starting out in the state of the row above, lexing stops right at the
+  // new row unless it changes the state of the rows below.
+  if (at < E.buf->syntax_rows)
+    {
+      e_row *prev = row_tree_prev (row);
+      row->hl_state = prev ? prev->hl_state : SYNTAX_NORMAL;
+      E.buf->syntax_rows++;
+      editor_row_changed (row);
+    }
+  else
+    editor_text_changed ();
+}
 
-  E.row[at].size = len;
-  E.row[at].text = malloc (len + 1);
-  memcpy (E.row[at].text, s, len);
-  E.row[at].text[len] = '\0';
+// Append a row that borrows its text from the file mapping.
+static void
+editor_append_mapped_row (char *s, size_t len)
+{
+  e_row *row = row_tree_insert (&E.buf->rows, E.buf->num_rows, 0);
 
-  E.row[at].r_size = 0;
-  E.row[at].renderer = NULL;
-  editor_update_row (&E.row[at]);
+  row->size = len;
+  row->text = s;
+  row->mapped = true;
+  editor_row_resized (row);
 
-  E.num_rows++;
-  E.modified = 1;
+  E.buf->num_rows++;
 }
 
 void
 editor_append_row (char *s, size_t len)
 {
-  int at = E.num_rows;
+  int at = E.buf->num_rows;
   editor_insert_row (at, s, len);
 }
 
@@ -192,12 +677,30 @@ editor_row_insert_char (e_row *row, int at, int c)
 {
   if (at < 0 || at > row->size)
     at = row->size;
-  row->text = realloc (row->text, row->size + 2);
+  char ch = c;
+  editor_record (UNDO_INSERT, row, at, &ch, 1);
+  editor_row_own (row);
+  editor_invalidate_row (row);
+  editor_row_reserve (row, row->size + 1);
   memmove (&row->text[at + 1], &row->text[at], row->size - at + 1);
   row->size++;
   row->text[at] = c;
-  editor_update_row (row);
-  E.modified = 1;
+  editor_row_changed (row);
+}
+
+void
+editor_row_insert_string (e_row *row, int at, const char *str, size_t length)
+{
+  if (at < 0 || at > row->size)
+    at = row->size;
+  editor_record (UNDO_INSERT, row, at, str, length);
+  editor_row_own (row);
+  editor_invalidate_row (row);
+  editor_row_reserve (row, row->size + length);
+  memmove (&row->text[at + length], &row->text[at], row->size - at + 1);
+  memcpy (&row->text[at], str, length);
+  row->size += length;
+  editor_row_changed (row);
 }
 
 void
@@ -205,440 +708,2449 @@ editor_row_delete_char (e_row *row, int at)
 {
   if (at < 0 || at >= row->size)
     return;
-  memmove (&row->text[at], &row->text[at + 1], row->size - at + 1);
+  editor_record (UNDO_DELETE, row, at, &row->text[at], 1);
+  editor_row_own (row);
+  editor_invalidate_row (row);
+  memmove (&row->text[at], &row->text[at + 1], row->size - at);
   row->size--;
-  editor_update_row (row);
-  E.modified = 1;
+  editor_row_changed (row);
+}
+
+void
+editor_row_delete_string (e_row *row, int at, size_t length)
+{
+  if (at < 0 || at >= row->size || length == 0)
+    return;
+  if (length > (size_t)(row->size - at))
+    length = row->size - at;
+  editor_record (UNDO_DELETE, row, at, &row->text[at], length);
+  editor_row_own (row);
+  editor_invalidate_row (row);
+  memmove (&row->text[at], &row->text[at + length],
+           row->size - at - length + 1);
+  row->size -= length;
+  editor_row_changed (row);
 }
 
 void
 editor_row_append_string (e_row *row, char *str, size_t length)
 {
-  row->text = realloc (row->text, row->size + length + 1);
+  editor_record (UNDO_INSERT, row, row->size, str, length);
+  editor_row_own (row);
+  editor_invalidate_row (row);
+  editor_row_reserve (row, row->size + length);
   memcpy (&row->text[row->size], str, length);
   row->size += length;
   row->text[row->size] = '\0';
-  editor_update_row (row);
-  E.modified = 1;
+  editor_row_changed (row);
+}
+
+void
+editor_free_row (e_row *row)
+{
+  editor_invalidate_row (row);
+  if (!row->mapped && !row_tree_text_inline (row))
+    row_arena_free (&E.buf->arena, row->text, row->capacity);
 }
 
 void
 editor_delete_row (int at)
 {
-  if (at < 0 || at >= E.num_rows)
+  if (at < 0 || at >= E.buf->num_rows)
     return;
   // free row
-  free (E.row[at].renderer);
-  free (E.row[at].text);
-  memmove (&E.row[at], &E.row[at + 1], sizeof (e_row) * (E.num_rows - at - 1));
-  E.num_rows--;
-  E.modified = 1;
+  e_row *row = row_tree_at (&E.buf->rows, at);
+  undo_record (&E.buf->undo, UNDO_DELETE_ROW, at, 0, row->text, row->size,
+               E.buf->cursor_y, E.buf->cursor_x);
+  swap_record (&E.buf->swap, UNDO_DELETE_ROW, at, 0, row->text, row->size);
+  editor_unsaved_from (at);
+  editor_row_deleted (row);
+  edit.row = NULL;
+  editor_free_row (row);
+  row_tree_remove (&E.buf->rows, row);
+  E.buf->num_rows--;
+  E.buf->modified = 1;
+  editor_text_changed ();
+
+  // The row that moved up now starts in a different state.
+  if (at < E.buf->syntax_rows)
+    {
+      E.buf->syntax_rows--;
+      e_row *next = row_tree_at (&E.buf->rows, at);
+      if (next)
+        editor_row_changed (next);
+    }
 }
 
 /************************ Editor operations ********************/
 
-void
-editor_insert_char (char c)
+// Whether the file is viewed read-only, see editor_open_view (). Edits and
+// saves leave it alone, and say so.
+static bool
+editor_read_only ()
 {
-  // The the cursor is at the end of file
-  if (E.cursor_y == E.num_rows)
-    editor_append_row ("", 0);
+  if (!E.buf->view.active)
+    return false;
 
-  editor_row_insert_char (&E.row[E.cursor_y], E.cursor_x, c);
-  E.cursor_x++;
+  editor_set_status_message ("File is too large to edit, it is viewed "
+                             "read-only");
+  return true;
 }
 
 void
-editor_delete_char ()
+editor_insert_char (char c)
 {
-  if (E.cursor_y == E.num_rows)
+  if (editor_read_only ())
     return;
 
-  if (E.cursor_y == 0 && E.cursor_x == 0)
-    return;
+  // The the cursor is at the end of file
+  if (E.buf->cursor_y == E.buf->num_rows)
+    editor_append_row ("", 0);
 
-  if (E.cursor_x > 0)
-    {
-      editor_row_delete_char (&E.row[E.cursor_y], E.cursor_x - 1);
-      E.cursor_x--;
-    }
-  else
-    {
-      E.cursor_x = E.row[E.cursor_y - 1].size;
-      editor_row_append_string (&E.row[E.cursor_y - 1], E.row[E.cursor_y].text,
-                                E.row[E.cursor_y].size);
-      editor_delete_row (E.cursor_y);
-      E.cursor_y--;
-    }
+  editor_row_insert_char (row_tree_at (&E.buf->rows, E.buf->cursor_y),
+                          E.buf->cursor_x, c);
+  E.buf->cursor_x++;
 }
 
-void
-editor_insert_newline ()
+// Length of the line at the start of TEXT, not counting its line break.
+static int
+editor_line_length (const char *text, int len)
 {
-  if (E.cursor_x == 0)
-    editor_insert_row (E.cursor_y, "", 0);
-  else
-    {
-      e_row *row = &E.row[E.cursor_y];
-      editor_insert_row (E.cursor_y + 1, &row->text[E.cursor_x],
-                         row->size - E.cursor_x);
-
-      // reassigning pointer as editor_insert_row() reallocates E.row
-      row = &E.row[E.cursor_y];
-      row->size = E.cursor_x;
-      row->text[row->size] = '\0';
-      editor_update_row (row);
-    }
-
-  E.cursor_y++;
-  E.cursor_x = 0;
+  int i = 0;
+  while (i < len && text[i] != '\n' && text[i] != '\r')
+    i++;
+  return i;
 }
 
-/************************ file i/o ********************/
-
-void
-editor_open (const char *file_name)
+// Insert TEXT at the cursor, leaving the cursor after it.
+static void
+editor_insert_lines (const char *text, int len)
 {
-  FILE *fp = fopen (file_name, "r");
-  E.filename = strdup (file_name);
-
-  if (!fp)
-    die ("fopen");
-
-  char *line = NULL;
-  size_t linecap = 0;
-  ssize_t linelen;
-  linelen = getline (&line, &linecap, fp);
+  e_row *row = row_tree_at (&E.buf->rows, E.buf->cursor_y);
+  int line_length = editor_line_length (text, len);
 
-  while (linelen != -1)
+  if (line_length == len)
     {
-      while (linelen > 0
-             && (line[linelen - 1] == '\n' || line[linelen - 1] == '\r'))
-        linelen--;
+      editor_row_insert_string (row, E.buf->cursor_x, text, len);
+      E.buf->cursor_x += len;
+      return;
+    }
 
-      editor_append_row (line, linelen);
+  // Move the text after the cursor aside, it ends up after the last line.
+  int tail_length = row->size - E.buf->cursor_x;
+  char *tail = malloc (tail_length);
+  memcpy (tail, &row->text[E.buf->cursor_x], tail_length);
+  editor_row_delete_string (row, E.buf->cursor_x, tail_length);
 
-      linelen = getline (&line, &linecap, fp);
+  editor_row_insert_string (row, E.buf->cursor_x, text, line_length);
+
+  int y = E.buf->cursor_y;
+  const char *end = text + len;
+  while (text + line_length < end)
+    {
+      text += line_length;
+      text += (text[0] == '\r' && text + 1 < end && text[1] == '\n') ? 2 : 1;
+      line_length = editor_line_length (text, end - text);
+      editor_insert_row (++y, (char *)text, line_length);
     }
 
-  free (line);
-  fclose (fp);
-  E.modified = 0;
+  row = row_tree_at (&E.buf->rows, y);
+  editor_row_insert_string (row, row->size, tail, tail_length);
+  free (tail);
+
+  E.buf->cursor_y = y;
+  E.buf->cursor_x = line_length;
 }
 
-// LEAK WARNING: the NEW_BUFFER is expected to free by caller
-char *
-editor_rows_to_string (int *buffer_length)
+// Insert a block of text at the cursor in one go, as for a paste. Each line
+// break, be it "\n", "\r" or "\r\n", starts a new row.
+void
+editor_insert_text (const char *text, int len)
 {
-  int total_length = 0;
-  for (int i = 0; i < E.num_rows; i++)
-    total_length += E.row[i].size + 1;
-  *buffer_length = total_length;
+  if (editor_read_only ())
+    return;
 
-  char *new_buffer = malloc (total_length);
-  char *p = new_buffer;
+  editor_begin_edit ();
+  if (E.buf->cursor_y == E.buf->num_rows)
+    editor_append_row ("", 0);
 
-  for (int i = 0; i < E.num_rows; i++)
+  // The block is journaled as a whole rather than row by row, with its line
+  // breaks as "\n" so that a "\r" in an entry always stays within a row.
+  struct abuf block = ABUF_INIT;
+  const char *end = text + len;
+  for (const char *line = text; line < end;)
     {
-      memcpy (p, E.row[i].text, E.row[i].size);
-      p += E.row[i].size;
-      *p = '\n';
-      p++;
+      int line_length = editor_line_length (line, end - line);
+      ab_append (&block, line, line_length);
+      line += line_length;
+      if (line == end)
+        break;
+      ab_append (&block, "\n", 1);
+      line += (line[0] == '\r' && line + 1 < end && line[1] == '\n') ? 2 : 1;
     }
-
-  return new_buffer;
+  undo_record (&E.buf->undo, UNDO_INSERT, E.buf->cursor_y, E.buf->cursor_x,
+               block.b, block.len, E.buf->cursor_y, E.buf->cursor_x);
+  ab_free (&block);
+  undo_suspend (&E.buf->undo);
+  editor_insert_lines (text, len);
+  undo_resume (&E.buf->undo);
+  editor_commit_edit ();
 }
 
-bool
-editor_save ()
+// Delete TEXT, as inserted by editor_insert_text (), from (Y, X) on.
+static void
+editor_delete_text (int y, int x, const char *text, int len)
 {
-  // TODO: Handle the case where the file is not provided in the begining.
-  if (E.filename == NULL)
-    return false;
+  e_row *row = row_tree_at (&E.buf->rows, y);
+  int line_length = editor_line_length (text, len);
 
-  int length;
-  char *buffer = editor_rows_to_string (&length);
-  int file_descriptor = open (E.filename, O_RDWR | O_CREAT, 0644);
+  if (line_length == len)
+    {
+      editor_row_delete_string (row, x, len);
+      return;
+    }
 
-  // TODO: perform some error handling where saving fails.
-  if (file_descriptor != -1)
+  // Find the row and column where the text ends.
+  int rows = 0;
+  const char *end = text + len;
+  while (text + line_length < end)
     {
-      if (ftruncate (file_descriptor, length) != -1)
-        {
-          if (write (file_descriptor, buffer, length) == length)
-            {
-              free (buffer);
-              close (file_descriptor);
-              return true;
-            }
-        }
-      close (file_descriptor);
+      text += line_length;
+      text += (text[0] == '\r' && text + 1 < end && text[1] == '\n') ? 2 : 1;
+      line_length = editor_line_length (text, end - text);
+      rows++;
     }
 
-  // Cleanup
-  free (buffer);
-  return false;
+  // Join what is left of the first and the last row.
+  e_row *last = row_tree_at (&E.buf->rows, y + rows);
+  editor_row_delete_string (row, x, row->size - x);
+  editor_row_append_string (row, &last->text[line_length],
+                            last->size - line_length);
+  for (int i = 0; i < rows; i++)
+    editor_delete_row (y + 1);
 }
 
-/************************* output ****************************/
-
 void
-editorScroll ()
+editor_delete_char ()
 {
-  E.renderer_x = 0;
+  if (editor_read_only ())
+    return;
 
-  if (E.cursor_y < E.num_rows)
-    E.renderer_x = editor_convert_cx_to_rx (&E.row[E.cursor_y], E.cursor_x);
+  if (E.buf->cursor_y == E.buf->num_rows)
+    return;
 
-  if (E.cursor_y < E.row_offset)
-    E.row_offset = E.cursor_y;
+  if (E.buf->cursor_y == 0 && E.buf->cursor_x == 0)
+    return;
+
+  e_row *row = row_tree_at (&E.buf->rows, E.buf->cursor_y);
+
+  // Delete the whole character before the cursor.
+  if (E.buf->cursor_x > 0)
+    {
+      int start = column_prev_char (row->text, row->size, E.buf->cursor_x);
+      editor_row_delete_string (row, start, E.buf->cursor_x - start);
+      E.buf->cursor_x = start;
+    }
+  else
+    {
+      e_row *prev = row_tree_prev (row);
+      int prev_size = prev->size;
+      editor_row_append_string (prev, row->text, row->size);
+      editor_delete_row (E.buf->cursor_y);
+      E.buf->cursor_y--;
+      E.buf->cursor_x = prev_size;
+    }
+}
+
+void
+editor_insert_newline ()
+{
+  if (editor_read_only ())
+    return;
+
+  if (E.buf->cursor_x == 0)
+    editor_insert_row (E.buf->cursor_y, "", 0);
+  else
+    {
+      // Rows never move in memory, so ROW stays valid across the insert.
+      e_row *row = row_tree_at (&E.buf->rows, E.buf->cursor_y);
+      editor_insert_row (E.buf->cursor_y + 1, &row->text[E.buf->cursor_x],
+                         row->size - E.buf->cursor_x);
+      editor_row_delete_string (row, E.buf->cursor_x,
+                                row->size - E.buf->cursor_x);
+    }
+
+  E.buf->cursor_y++;
+  E.buf->cursor_x = 0;
+}
+
+int
+editor_replace_all (const char *pattern, int len, const char *with,
+                    int with_len)
+{
+  if (editor_read_only ())
+    return 0;
+
+  if (len == 0)
+    return 0;
+
+  // Rows are rewritten into SCRATCH, kept across calls.
+  static struct abuf scratch = ABUF_INIT;
+
+  int count = 0;
+  e_row *cursor_row = row_tree_at (&E.buf->rows, E.buf->cursor_y);
+  editor_begin_edit ();
+
+  for (e_row *row = row_tree_at (&E.buf->rows, 0); row;
+       row = row_tree_next (row))
+    {
+      int first = search_find (row->text, row->size, pattern, len, 0);
+      if (first < 0)
+        continue;
+
+      // The span from the first match to the end of the last one is
+      // replaced in one pass, and journaled as one deletion and one
+      // insertion however many matches it holds.
+      int end = first;
+      int cursor = -1;
+      int shift = 0;
+      ab_reset (&scratch);
+      for (int at = first; at >= 0;
+           at = search_find (row->text, row->size, pattern, len, end))
+        {
+          ab_append (&scratch, &row->text[end], at - end);
+          ab_append (&scratch, with, with_len);
+          end = at + len;
+          count++;
+
+          // A cursor inside the match goes to the start of its replacement.
+          if (row == cursor_row && cursor == -1 && at < E.buf->cursor_x)
+            {
+              if (end <= E.buf->cursor_x)
+                shift += with_len - len;
+              else
+                cursor = at + shift;
+            }
+        }
+      if (row == cursor_row)
+        E.buf->cursor_x = cursor != -1 ? cursor : E.buf->cursor_x + shift;
+
+      editor_record (UNDO_DELETE, row, first, &row->text[first], end - first);
+      if (scratch.len > 0)
+        editor_record (UNDO_INSERT, row, first, scratch.b, scratch.len);
+
+      editor_row_own (row);
+      editor_invalidate_row (row);
+      editor_row_reserve (row, row->size + scratch.len - (end - first));
+      memmove (&row->text[first + scratch.len], &row->text[end],
+               row->size - end + 1);
+      memcpy (&row->text[first], scratch.b, scratch.len);
+      row->size += scratch.len - (end - first);
+      editor_row_changed (row);
+    }
+
+  editor_commit_edit ();
+  return count;
+}
+
+// Bytes of indentation at the start of ROW that one level of outdent takes
+// off: a tab, or up to TAB_SIZE spaces.
+static int
+editor_indent_level (const e_row *row)
+{
+  if (row->size > 0 && row->text[0] == '\t')
+    return 1;
+
+  int spaces = 0;
+  while (spaces < TAB_SIZE && spaces < row->size && row->text[spaces] == ' ')
+    spaces++;
+  return spaces;
+}
+
+void
+editor_indent_rows (int from, int to, bool outdent)
+{
+  if (editor_read_only ())
+    return;
+
+  if (from < 0)
+    from = 0;
+  if (to >= E.buf->num_rows)
+    to = E.buf->num_rows - 1;
+
+  editor_begin_edit ();
+
+  e_row *row = row_tree_at (&E.buf->rows, from);
+  for (int y = from; y <= to; y++, row = row_tree_next (row))
+    {
+      if (row->size == 0)
+        continue;
+
+      int delta = 1;
+      if (outdent)
+        {
+          delta = -editor_indent_level (row);
+          editor_row_delete_string (row, 0, -delta);
+        }
+      else
+        editor_row_insert_char (row, 0, '\t');
+
+      if (y == E.buf->cursor_y)
+        {
+          E.buf->cursor_x += delta;
+          if (E.buf->cursor_x < 0)
+            E.buf->cursor_x = 0;
+        }
+    }
+
+  editor_commit_edit ();
+}
+
+// Replay ENTRY, or revert it if UNDO is set, leaving the cursor where the
+// change happened.
+static void
+editor_apply_entry (const struct undo_entry *entry, bool undo)
+{
+  enum undo_kind kind = entry->kind;
+  if (undo)
+    {
+      static const enum undo_kind inverse[] = {
+        [UNDO_INSERT] = UNDO_DELETE,
+        [UNDO_DELETE] = UNDO_INSERT,
+        [UNDO_INSERT_ROW] = UNDO_DELETE_ROW,
+        [UNDO_DELETE_ROW] = UNDO_INSERT_ROW,
+      };
+      kind = inverse[kind];
+    }
+
+  E.buf->cursor_y = entry->y;
+  E.buf->cursor_x = entry->x;
+
+  // Entries without a "\n" stay within their row, even if they hold a "\r".
+  e_row *row = row_tree_at (&E.buf->rows, entry->y);
+  bool within_row = row && !memchr (entry->text, '\n', entry->len);
+
+  switch (kind)
+    {
+    case UNDO_INSERT:
+      if (within_row)
+        {
+          editor_row_insert_string (row, entry->x, entry->text, entry->len);
+          E.buf->cursor_x += entry->len;
+        }
+      else
+        editor_insert_text (entry->text, entry->len);
+      break;
+    case UNDO_DELETE:
+      if (within_row)
+        editor_row_delete_string (row, entry->x, entry->len);
+      else
+        editor_delete_text (entry->y, entry->x, entry->text, entry->len);
+      break;
+    case UNDO_INSERT_ROW:
+      editor_insert_row (entry->y, entry->text, entry->len);
+      break;
+    case UNDO_DELETE_ROW:
+      editor_delete_row (entry->y);
+      break;
+    }
+}
+
+// Revert the last step, the cursor goes back to where it was before it.
+void
+editor_undo ()
+{
+  if (editor_read_only ())
+    return;
+
+  if (E.buf->undo.newest == NULL)
+    {
+      editor_set_status_message ("Nothing to undo");
+      return;
+    }
+
+  unsigned long group = E.buf->undo.newest->group;
+  struct undo_entry *entry, *first = NULL;
+
+  editor_begin_edit ();
+  undo_suspend (&E.buf->undo);
+  while ((entry = undo_pop (&E.buf->undo, group)))
+    {
+      editor_apply_entry (entry, true);
+      first = entry;
+    }
+  undo_resume (&E.buf->undo);
+  editor_commit_edit ();
+
+  // Typing after an undo must not extend the step before it.
+  undo_break (&E.buf->undo);
+  E.buf->cursor_y = first->cursor_y;
+  E.buf->cursor_x = first->cursor_x;
+}
+
+void
+editor_redo ()
+{
+  if (editor_read_only ())
+    return;
+
+  if (E.buf->undo.redo == NULL)
+    {
+      editor_set_status_message ("Nothing to redo");
+      return;
+    }
+
+  unsigned long group = E.buf->undo.redo->group;
+  struct undo_entry *entry;
+
+  editor_begin_edit ();
+  undo_suspend (&E.buf->undo);
+  while ((entry = undo_pop_redo (&E.buf->undo, group)))
+    editor_apply_entry (entry, false);
+  undo_resume (&E.buf->undo);
+  editor_commit_edit ();
+  undo_break (&E.buf->undo);
+}
+
+/************************ file i/o ********************/
+
+static void editor_loaded ();
+static void editor_offer_recovery ();
+
+// Split the mapped file into rows that point into the mapping, nothing is
+// copied until a row is edited.
+static void
+editor_open_mapped (char *map, size_t size)
+{
+  char *line = map;
+  char *end = map + size;
+
+  while (line < end)
+    {
+      char *newline = memchr (line, '\n', end - line);
+      char *next = newline ? newline + 1 : end;
+
+      size_t linelen = next - line;
+      while (linelen > 0
+             && (line[linelen - 1] == '\n' || line[linelen - 1] == '\r'))
+        linelen--;
+
+      editor_append_mapped_row (line, linelen);
+      line = next;
+    }
+}
+
+// Take in the parts of the file loaded so far, waiting for the next one with
+// WAIT. Once the whole file is in, edits to it can be journaled.
+static void
+editor_load_merge (bool wait)
+{
+  long long start = trace_now_us ();
+  int rows = loader_merge (&E.buf->loader, &E.buf->rows, &E.buf->arena, wait);
+  if (rows > 0)
+    trace_span ("load", start, "\"rows\":%d", rows);
+
+  // The rows of the parts come without their screen lines.
+  if (E.buf->wrap_width)
+    for (e_row *row = row_tree_at (&E.buf->rows, E.buf->num_rows); row;
+         row = row_tree_next (row))
+      editor_row_resized (row);
+
+  E.buf->num_rows += rows;
+  if (!E.buf->loader.active)
+    editor_loaded ();
+}
+
+void
+editor_load_wait ()
+{
+  while (E.buf->loader.active)
+    editor_load_merge (true);
+}
+
+// Replace the rows with the window of the viewed file around LINE, the
+// cursor and the scroll position stay on the same lines of the file.
+static bool
+editor_view_load (long long line)
+{
+  long long first = E.buf->view.first;
+  if (!file_view_load (&E.buf->view, line))
+    return false;
+
+  render_cache_clear ();
+  search_reset (&E.buf->search);
+  row_tree_clear (&E.buf->rows);
+  row_arena_release (&E.buf->arena);
+  E.buf->num_rows = 0;
+
+  undo_suspend (&E.buf->undo);
+  editor_open_mapped (E.buf->view.text, E.buf->view.text_len);
+  undo_resume (&E.buf->undo);
+  E.buf->view_appended = 0;
+
+  E.buf->cursor_y += first - E.buf->view.first;
+  E.buf->row_offset += first - E.buf->view.first;
+  if (E.buf->row_offset < 0)
+    E.buf->row_offset = 0;
+  return true;
+}
+
+// Move the window of the viewed file along with the cursor. A screen of
+// lines above the cursor and two below are kept in the window, so any
+// single key press stays within it.
+static void
+editor_view_follow ()
+{
+  bool above = E.buf->view.first > 0 && E.buf->cursor_y < E.screen_rows;
+  bool below = !E.buf->view.eof
+               && E.buf->num_rows - E.buf->cursor_y < 2 * E.screen_rows;
+
+  if (above || below)
+    editor_view_load (E.buf->view.first + E.buf->cursor_y);
+}
+
+// Files too large to load are only viewed, a window of lines at a time.
+static void
+editor_open_view (int file_descriptor, off_t size)
+{
+  E.buf->syntax = NULL;
+  file_view_open (&E.buf->view, file_descriptor, size);
+  editor_view_load (0);
+}
+
+void
+editor_open (const char *file_name)
+{
+  E.buf->filename = strdup (file_name);
+  E.buf->syntax = syntax_select (file_name);
+  E.buf->syntax_rows = 0;
+
+  // Loading the file is not an edit that could be undone.
+  undo_suspend (&E.buf->undo);
+
+  int file_descriptor = open (file_name, O_RDONLY);
+  if (file_descriptor == -1)
+    die ("open");
+
+  // Regular files are mapped so that untouched lines stay in the shared
+  // page cache, anything else falls back to reading line by line.
+  struct stat st;
+  bool regular = fstat (file_descriptor, &st) == 0 && S_ISREG (st.st_mode);
+  E.buf->file_size = regular ? st.st_size : 0;
+  if (regular && st.st_size >= VIEW_MIN_SIZE)
+    {
+      editor_open_view (file_descriptor, st.st_size);
+      E.buf->modified = 0;
+      undo_resume (&E.buf->undo);
+      return;
+    }
+
+  if (regular && st.st_size > 0)
+    {
+      char *map = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE,
+                        file_descriptor, 0);
+      if (map != MAP_FAILED)
+        {
+          close (file_descriptor);
+          E.buf->map = map;
+          E.buf->map_size = st.st_size;
+          E.buf->modified = 0;
+          undo_resume (&E.buf->undo);
+
+          // Larger files are split into rows by worker threads, and shown
+          // as soon as the first screen of them is in.
+          if (st.st_size > LOADER_FIRST_PART)
+            {
+              loader_start (&E.buf->loader, map, st.st_size);
+              editor_load_merge (true);
+              return;
+            }
+
+          editor_open_mapped (map, st.st_size);
+          editor_loaded ();
+          return;
+        }
+    }
+
+  FILE *fp = fdopen (file_descriptor, "r");
+  if (!fp)
+    die ("fdopen");
+
+  char *line = NULL;
+  size_t linecap = 0;
+  ssize_t linelen;
+  linelen = getline (&line, &linecap, fp);
+
+  while (linelen != -1)
+    {
+      while (linelen > 0
+             && (line[linelen - 1] == '\n' || line[linelen - 1] == '\r'))
+        linelen--;
+
+      editor_append_row (line, linelen);
+
+      linelen = getline (&line, &linecap, fp);
+    }
+
+  free (line);
+  fclose (fp);
+  E.buf->modified = 0;
+  undo_resume (&E.buf->undo);
+  editor_loaded ();
+}
+
+// The whole file is in. A save rewrites the file from the first row edited
+// on, unless it differs from how it is saved: lines that end with "\r\n"
+// change all of it, and a missing newline at the end changes the last row.
+static void
+editor_loaded ()
+{
+  long long bytes = row_tree_bytes (&E.buf->rows);
+  bool newline = E.buf->map && E.buf->map[E.buf->map_size - 1] == '\n';
+
+  if (E.buf->map == NULL)
+    E.buf->save_from = 0;
+  else if (newline)
+    E.buf->save_from = bytes == E.buf->file_size ? INT_MAX : 0;
+  else
+    E.buf->save_from
+        = bytes - 1 == E.buf->file_size ? E.buf->num_rows - 1 : 0;
+
+  if (stat (E.buf->filename, &E.buf->saved) == -1)
+    memset (&E.buf->saved, 0, sizeof (E.buf->saved));
+  E.buf->map_on_disk = E.buf->map != NULL;
+
+  editor_offer_recovery ();
+}
+
+// Size of the pages that editor_handle_sigbus () replaces.
+static long page_size;
+
+// A mapped file that was truncated raises SIGBUS when read past its new
+// end. The page read is replaced with zeros, so that the rows pointing
+// there can still be copied out, and the buffer is detached from the file
+// by the next editor_background_step (). Any other SIGBUS stays fatal.
+static void
+editor_handle_sigbus (int sig, siginfo_t *info, void *context)
+{
+  (void)context;
+  char *address = info->si_addr;
+
+  for (int i = 0; i < E.num_buffers; i++)
+    {
+      struct buffer *buf = E.buffers[i];
+      if (buf->map == NULL || address < buf->map
+          || address >= buf->map + buf->map_size)
+        continue;
+
+      char *page = (char *)((uintptr_t)address & ~(uintptr_t)(page_size - 1));
+      if (mmap (page, page_size, PROT_READ,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0)
+          == MAP_FAILED)
+        break;
+      buf->map_truncated = true;
+      return;
+    }
+
+  signal (sig, SIG_DFL);
+}
+
+static void
+editor_watch_truncation ()
+{
+  page_size = sysconf (_SC_PAGESIZE);
+
+  struct sigaction sa;
+  sa.sa_sigaction = editor_handle_sigbus;
+  sigemptyset (&sa.sa_mask);
+  sa.sa_flags = SA_SIGINFO | SA_RESTART;
+  if (sigaction (SIGBUS, &sa, NULL) == -1)
+    die ("sigaction");
+}
+
+// Copy the rows that point into the mapping out of it and drop it, as the
+// file no longer holds them. What was cut off the file is lost, it reads
+// as zeros.
+static void
+editor_map_detach ()
+{
+  editor_load_wait ();
+  for (e_row *row = row_tree_at (&E.buf->rows, 0); row;
+       row = row_tree_next (row))
+    editor_row_own (row);
+
+  munmap (E.buf->map, E.buf->map_size);
+  E.buf->map = NULL;
+  E.buf->map_size = 0;
+  E.buf->map_on_disk = false;
+  E.buf->map_truncated = false;
+  E.buf->save_from = 0;
+}
+
+// Append the LENGTH bytes at TEXT to the batch IOV of COUNT pieces, as part
+// of the last piece if they follow right after it.
+static void
+editor_batch_add (struct iovec *iov, int *count, char *text, size_t length)
+{
+  struct iovec *last = *count ? &iov[*count - 1] : NULL;
+  if (last && (char *)last->iov_base + last->iov_len == text)
+    last->iov_len += length;
+  else
+    {
+      iov[*count].iov_base = text;
+      iov[*count].iov_len = length;
+      (*count)++;
+    }
+}
+
+// Stream the rows from FIRST on, each followed by a newline, to
+// FILE_DESCRIPTOR in batches of vectored writes, without building a copy of
+// the document.
+static ssize_t
+editor_write_rows (int file_descriptor, e_row *first)
+{
+  static char newline[] = "\n";
+  static char stage[SAVE_STAGE_BYTES];
+  struct iovec iov[SAVE_BATCH_ROWS * 2];
+  int count = 0;
+  int staged = 0;
+  ssize_t total = 0;
+  const char *map_end = E.buf->map + E.buf->map_size;
+
+  for (e_row *row = first; row; row = row_tree_next (row))
+    {
+      // Unedited rows are followed by their newline in the mapping, and a
+      // run of them goes out as a single piece.
+      bool ends_line = row->mapped && row->text >= E.buf->map
+                       && row->text + row->size < map_end
+                       && row->text[row->size] == '\n';
+
+      if (ends_line)
+        editor_batch_add (iov, &count, row->text, row->size + 1);
+      else if (row->size < SAVE_STAGE_ROW)
+        {
+          char *text = &stage[staged];
+          memcpy (text, row->text, row->size);
+          text[row->size] = '\n';
+          staged += row->size + 1;
+          editor_batch_add (iov, &count, text, row->size + 1);
+        }
+      else
+        {
+          editor_batch_add (iov, &count, row->text, row->size);
+          editor_batch_add (iov, &count, newline, 1);
+        }
+
+      if (count > SAVE_BATCH_ROWS * 2 - 2
+          || staged > SAVE_STAGE_BYTES - SAVE_STAGE_ROW)
+        {
+          ssize_t written = ab_writev (file_descriptor, iov, count);
+          if (written == -1)
+            return -1;
+          total += written;
+          count = 0;
+          staged = 0;
+        }
+    }
+
+  ssize_t written = ab_writev (file_descriptor, iov, count);
+  if (written == -1)
+    return -1;
+
+  return total + written;
+}
+
+// LEAK WARNING: the returned path is expected to free by caller
+static char *
+editor_temp_path (const char *target)
+{
+  const char *slash = strrchr (target, '/');
+  int dir_length = slash ? slash - target + 1 : 0;
+  const char *base = slash ? slash + 1 : target;
+
+  size_t length = strlen (target) + sizeof ("..XXXXXX");
+  char *path = malloc (length);
+  snprintf (path, length, "%.*s.%s.XXXXXX", dir_length, target, base);
+  return path;
+}
+
+// Drop the open document and everything that belongs to it.
+void
+editor_close ()
+{
+  // Rows, their text and the tree nodes all live in the arena, so the
+  // whole document is released at once.
+  loader_free (&E.buf->loader);
+  render_cache_clear ();
+  search_free (&E.buf->search);
+  row_tree_clear (&E.buf->rows);
+  row_arena_release (&E.buf->arena);
+  E.buf->num_rows = 0;
+  undo_free (&E.buf->undo);
+
+  if (E.buf->map)
+    munmap (E.buf->map, E.buf->map_size);
+  E.buf->map = NULL;
+  E.buf->map_size = 0;
+  E.buf->map_truncated = false;
+  file_view_free (&E.buf->view);
+  follow_stop (&E.buf->follow);
+  E.buf->file_size = 0;
+  swap_free (&E.buf->swap);
+
+  free (E.buf->filename);
+  E.buf->filename = NULL;
+  E.buf->syntax = NULL;
+  E.buf->syntax_rows = 0;
+
+  E.buf->recovery_pending = false;
+  E.buf->view_appended = 0;
+
+  E.buf->cursor_x = 0;
+  E.buf->cursor_y = 0;
+  E.buf->renderer_x = 0;
+  E.buf->row_offset = 0;
+  E.buf->col_offset = 0;
+  E.buf->line_offset = 0;
+  E.buf->modified = 0;
+  E.buf->save_from = 0;
+  memset (&E.buf->saved, 0, sizeof (E.buf->saved));
+  E.buf->map_on_disk = false;
+}
+
+// FNV-1a hash of the LEN bytes of DATA, going on from HASH.
+static uint64_t
+editor_hash (uint64_t hash, const char *data, size_t len)
+{
+  for (size_t i = 0; i < len; i++)
+    hash = (hash ^ (unsigned char)data[i]) * 1099511628211ULL;
+  return hash;
+}
+
+// Whether the rows from FIRST on hash the same as the file TARGET does from
+// OFFSET to its end, as when edits were reverted. The file is as long as
+// the rows.
+static bool
+editor_save_unchanged (const char *target, e_row *first, off_t offset)
+{
+  uint64_t rows = 14695981039346656037ULL;
+  for (e_row *row = first; row; row = row_tree_next (row))
+    {
+      rows = editor_hash (rows, row->text, row->size);
+      rows = editor_hash (rows, "\n", 1);
+    }
+
+  int file_descriptor = open (target, O_RDONLY);
+  if (file_descriptor == -1)
+    return false;
+
+  static char buffer[64 * 1024];
+  uint64_t file = 14695981039346656037ULL;
+  ssize_t n;
+  while ((n = pread (file_descriptor, buffer, sizeof (buffer), offset)) > 0)
+    {
+      file = editor_hash (file, buffer, n);
+      offset += n;
+    }
+  close (file_descriptor);
+
+  return n == 0 && rows == file;
+}
+
+// Flush FILE_DESCRIPTOR to disk and close it, false with FAILED set if
+// either does not work out.
+static bool
+editor_save_close (int file_descriptor, bool ok, const char **failed)
+{
+  if (ok && SAVE_FSYNC && fsync (file_descriptor) == -1)
+    {
+      *failed = "fsync";
+      ok = false;
+    }
+
+  if (close (file_descriptor) == -1 && ok)
+    {
+      *failed = "close";
+      ok = false;
+    }
+
+  return ok;
+}
+
+// The document is written to a temporary file next to the target which is
+// then renamed over it, so the old contents survive a failed save. Mapped
+// rows stay valid since the mapping keeps the replaced file alive. Return
+// the bytes written, -1 with FAILED set on error.
+static ssize_t
+editor_save_whole (const char *target, const char **failed)
+{
+  char *temp = editor_temp_path (target);
+  ssize_t length = -1;
+
+  *failed = "open";
+  int file_descriptor = mkstemp (temp);
+  if (file_descriptor != -1)
+    {
+      // Keep the permissions of the file being replaced.
+      struct stat st;
+      mode_t mode;
+      if (stat (target, &st) == 0)
+        mode = st.st_mode & 07777;
+      else
+        {
+          mode_t mask = umask (0);
+          umask (mask);
+          mode = 0644 & ~mask;
+        }
+
+      *failed = "chmod";
+      if (fchmod (file_descriptor, mode) != -1)
+        {
+          *failed = "write";
+          length = editor_write_rows (file_descriptor,
+                                      row_tree_at (&E.buf->rows, 0));
+        }
+
+      if (!editor_save_close (file_descriptor, length != -1, failed))
+        length = -1;
+
+      if (length != -1)
+        {
+          *failed = "rename";
+          if (rename (temp, target) == -1)
+            length = -1;
+        }
+
+      if (length == -1)
+        {
+          int saved_errno = errno;
+          unlink (temp);
+          errno = saved_errno;
+        }
+      else
+        E.buf->map_on_disk = false;
+    }
+
+  free (temp);
+  return length;
+}
+
+// Same as editor_write_rows (), for swap_record_tail ().
+static ssize_t
+editor_write_tail (int file_descriptor, const void *first)
+{
+  return editor_write_rows (file_descriptor, (e_row *)first);
+}
+
+// Journal the rows from FIRST on, which start at byte OFFSET of the file
+// and take LENGTH bytes, ahead of writing them in place. False if that
+// failed, the file must then be replaced as a whole.
+static bool
+editor_journal_tail (e_row *first, off_t offset, long long length)
+{
+  return swap_record_tail (&E.buf->swap, row_tree_index_of (first), offset,
+                           length, editor_write_tail, first);
+}
+
+// Write the rows from FIRST on over the file TARGET from OFFSET on, which
+// is then cut where they end. Return the bytes written, -1 with FAILED set
+// on error. The rows are journaled by editor_journal_tail (), so that a
+// write cut short can be recovered from the swap file.
+static ssize_t
+editor_save_tail (const char *target, e_row *first, off_t offset,
+                  const char **failed)
+{
+  // Rows that point into the mapping of the file would change along.
+  if (E.buf->map_on_disk)
+    for (e_row *row = first; row; row = row_tree_next (row))
+      editor_row_own (row);
+
+  *failed = "open";
+  int file_descriptor = open (target, O_WRONLY);
+  if (file_descriptor == -1)
+    return -1;
+
+  ssize_t length = -1;
+  *failed = "seek";
+  if (lseek (file_descriptor, offset, SEEK_SET) != -1)
+    {
+      *failed = "write";
+      length = editor_write_rows (file_descriptor, first);
+    }
+
+  if (length != -1)
+    {
+      *failed = "truncate";
+      if (ftruncate (file_descriptor, offset + length) == -1)
+        length = -1;
+    }
+
+  if (!editor_save_close (file_descriptor, length != -1, failed))
+    length = -1;
+  return length;
+}
+
+bool
+editor_save ()
+{
+  if (editor_read_only ())
+    return false;
+
+  // TODO: Handle the case where the file is not provided in the begining.
+  if (E.buf->filename == NULL)
+    return false;
+
+  // The whole document is written, not just what is loaded so far.
+  editor_load_wait ();
+
+  long long start = trace_now_us ();
+
+  // Replace the file a symlink points to rather than the symlink itself.
+  char *target = realpath (E.buf->filename, NULL);
+  if (target == NULL)
+    target = strdup (E.buf->filename);
+
+  struct stat st;
+  bool same_file = stat (target, &st) == 0
+                   && st.st_dev == E.buf->saved.st_dev
+                   && st.st_ino == E.buf->saved.st_ino;
+  bool same = same_file && st.st_size == E.buf->saved.st_size
+              && st.st_mtim.tv_sec == E.buf->saved.st_mtim.tv_sec
+              && st.st_mtim.tv_nsec == E.buf->saved.st_mtim.tv_nsec;
+
+  // Writing rows past the end of a truncated file would fail.
+  if (E.buf->map_on_disk && same_file && st.st_size < E.buf->saved.st_size)
+    editor_map_detach ();
+
+  e_row *first = row_tree_at (&E.buf->rows, E.buf->save_from);
+  long long bytes = row_tree_bytes (&E.buf->rows);
+  long long offset = first ? row_tree_offset_of (first) : bytes;
+
+  const char *failed;
+  ssize_t written = 0;
+  bool unchanged
+      = same && bytes == st.st_size
+        && (first == NULL || editor_save_unchanged (target, first, offset));
+  if (!unchanged && same && offset > 0 && offset >= bytes - offset
+      && editor_journal_tail (first, offset, bytes - offset))
+    written = editor_save_tail (target, first, offset, &failed);
+  else if (!unchanged)
+    {
+      offset = 0;
+      written = editor_save_whole (target, &failed);
+    }
+
+  if (written == -1)
+    editor_set_status_message ("Can't save ! %s: %s", failed,
+                               strerror (errno));
+  else
+    {
+      // The journaled edits are in the file now, which is a new one to
+      // follow.
+      off_t length = offset + written;
+      swap_discard (&E.buf->swap);
+      E.buf->file_size = length;
+      E.buf->save_from = INT_MAX;
+      if (stat (target, &E.buf->saved) == -1)
+        memset (&E.buf->saved, 0, sizeof (E.buf->saved));
+      if (E.buf->follow.active)
+        {
+          follow_stop (&E.buf->follow);
+          follow_start (&E.buf->follow, E.buf->filename, length);
+        }
+
+      double ms = trace_span ("save", start, "\"bytes\":%zd,\"offset\":%lld",
+                              written, offset)
+                  / 1e3;
+      if (unchanged)
+        editor_set_status_message ("No changes to save");
+      else if (offset > 0)
+        editor_set_status_message (
+            "%zd bytes written from byte %lld in %.1f ms", written, offset,
+            ms);
+      else
+        editor_set_status_message (
+            "%zd bytes written in %.1f ms (%.1f MB/s)", written, ms,
+            ms > 0 ? written / ms / 1e3 : 0.0);
+    }
+
+  free (target);
+  return written != -1;
+}
+
+// Append what was appended to the followed file to the rows, the first
+// piece continuing the last row if that had no newline yet. Return the
+// number of bytes read.
+static size_t
+editor_follow_append ()
+{
+  static char buffer[FOLLOW_CHUNK];
+  size_t total = 0;
+
+  // Rows read from the file are neither edits to undo nor to journal, nor
+  // do they differ from it.
+  bool modified = E.buf->modified;
+  int save_from = E.buf->save_from;
+  bool journaling = E.buf->swap.active;
+  undo_suspend (&E.buf->undo);
+  E.buf->swap.active = false;
+
+  bool partial = E.buf->follow.partial;
+  ssize_t n;
+  while ((n = follow_read (&E.buf->follow, buffer, sizeof (buffer))) > 0)
+    {
+      char *line = buffer;
+      char *end = buffer + n;
+      while (line < end)
+        {
+          char *newline = memchr (line, '\n', end - line);
+          int len = (newline ? newline : end) - line;
+
+          e_row *last = row_tree_at (&E.buf->rows, E.buf->num_rows - 1);
+          if (partial && last)
+            editor_row_append_string (last, line, len);
+          else
+            editor_append_row (line, len);
+
+          // Same as when loading, a line ends with "\n" or "\r\n".
+          last = row_tree_at (&E.buf->rows, E.buf->num_rows - 1);
+          if (newline && last->size > 0 && last->text[last->size - 1] == '\r')
+            editor_row_delete_char (last, last->size - 1);
+
+          partial = newline == NULL;
+          line = newline ? newline + 1 : end;
+        }
+      total += n;
+    }
+
+  undo_resume (&E.buf->undo);
+  E.buf->swap.active = journaling;
+  E.buf->modified = modified;
+  E.buf->save_from = save_from;
+  E.buf->file_size = E.buf->follow.offset;
+  return total;
+}
+
+// The followed file grew: rows are appended to a loaded file. A viewed one
+// only gets them while its window reaches the end of the file, and the
+// window is loaded anew once they would take more room than it does.
+static void
+editor_follow_grown ()
+{
+  // Rows are appended after the ones still being loaded.
+  editor_load_wait ();
+
+  bool at_end = E.buf->cursor_y >= E.buf->num_rows - 1;
+
+  if (E.buf->view.active)
+    {
+      file_view_grow (&E.buf->view, E.buf->follow.size);
+      if (!E.buf->view.eof)
+        {
+          follow_skip (&E.buf->follow);
+          return;
+        }
+
+      E.buf->view_appended += editor_follow_append ();
+      if (E.buf->view_appended > FILE_VIEW_WINDOW / 2)
+        editor_view_load (E.buf->view.first + E.buf->cursor_y);
+    }
+  else
+    editor_follow_append ();
+
+  // Keep the end in view while the cursor is there, as tail -f does.
+  if (at_end && E.buf->num_rows > 0)
+    {
+      E.buf->cursor_y = E.buf->num_rows - 1;
+      E.buf->cursor_x = 0;
+    }
+}
+
+// The followed file was truncated or replaced, e.g. by log rotation. It is
+// loaded anew unless that would lose unsaved changes.
+static void
+editor_follow_reopen ()
+{
+  if (E.buf->modified)
+    {
+      // Rows past the end of a truncated file would fault once read.
+      if (E.buf->map_on_disk && E.buf->follow.size < E.buf->follow.offset)
+        editor_map_detach ();
+      follow_stop (&E.buf->follow);
+      editor_set_status_message ("File was replaced, stopped following it to "
+                                 "keep unsaved changes");
+      return;
+    }
+
+  char *file_name = strdup (E.buf->filename);
+  editor_close ();
+  editor_open (file_name);
+  free (file_name);
+
+  editor_follow (true);
+  editor_set_status_message ("File was replaced, reloaded it");
+}
+
+void
+editor_follow (bool enable)
+{
+  if (!enable || E.buf->filename == NULL)
+    {
+      follow_stop (&E.buf->follow);
+      return;
+    }
+
+  // Following starts from the end of the file.
+  editor_load_wait ();
+  if (!follow_start (&E.buf->follow, E.buf->filename, E.buf->file_size))
+    {
+      editor_set_status_message ("Can't follow file ! %s", strerror (errno));
+      return;
+    }
+
+  // Catch up with what was appended since the file was loaded, and go to
+  // its end as tail -f does. The end of a viewed file is only known once it
+  // is indexed, it is followed from wherever its window is.
+  if (E.buf->follow.size > E.buf->follow.offset)
+    editor_follow_grown ();
+  if (!E.buf->view.active)
+    {
+      E.buf->cursor_y = E.buf->num_rows > 0 ? E.buf->num_rows - 1 : 0;
+      E.buf->cursor_x = 0;
+    }
+}
+
+int
+editor_follow_fd ()
+{
+  return follow_fd (&E.buf->follow);
+}
+
+int
+editor_load_fd ()
+{
+  return loader_fd (&E.buf->loader);
+}
+
+/************************* output ****************************/
+
+// Screen line of the cursor while soft wrapping, counted from the top of
+// the document.
+static int
+editor_cursor_line ()
+{
+  e_row *row = row_tree_at (&E.buf->rows, E.buf->cursor_y);
+  if (row == NULL)
+    return row_tree_lines (&E.buf->rows);
+
+  return row_tree_line_of (row) + E.buf->renderer_x / E.buf->wrap_width;
+}
+
+// Scroll by screen lines so that the cursor stays in view. What moved the
+// view by rows, like going to a line, moved it to the first line of the
+// top row.
+static void
+editor_scroll_wrapped ()
+{
+  editor_wrap_update ();
+  E.buf->col_offset = 0;
+
+  int first;
+  e_row *top = row_tree_at_line (&E.buf->rows, E.buf->line_offset, &first);
+  int top_index = top ? row_tree_index_of (top) : E.buf->num_rows;
+  if (top_index != E.buf->row_offset)
+    {
+      top = row_tree_at (&E.buf->rows, E.buf->row_offset);
+      E.buf->line_offset
+          = top ? row_tree_line_of (top) : row_tree_lines (&E.buf->rows);
+    }
+
+  int line = editor_cursor_line ();
+  if (line < E.buf->line_offset)
+    E.buf->line_offset = line;
+  if (line >= E.buf->line_offset + E.screen_rows)
+    E.buf->line_offset = line - E.screen_rows + 1;
+
+  top = row_tree_at_line (&E.buf->rows, E.buf->line_offset, &first);
+  E.buf->row_offset = top ? row_tree_index_of (top) : E.buf->num_rows;
+}
+
+void
+editorScroll ()
+{
+  E.buf->renderer_x = 0;
+
+  if (E.buf->cursor_y < E.buf->num_rows)
+    E.buf->renderer_x = editor_convert_cx_to_rx (
+        row_tree_at (&E.buf->rows, E.buf->cursor_y), E.buf->cursor_x);
+
+  if (E.soft_wrap)
+    {
+      editor_scroll_wrapped ();
+      return;
+    }
+
+  if (E.buf->cursor_y < E.buf->row_offset)
+    E.buf->row_offset = E.buf->cursor_y;
+
+  if (E.buf->cursor_y >= E.buf->row_offset + E.screen_rows)
+    E.buf->row_offset = E.buf->cursor_y - E.screen_rows + 1;
+
+  if (E.buf->renderer_x < E.buf->col_offset)
+    E.buf->col_offset = E.buf->renderer_x;
+
+  if (E.buf->renderer_x >= E.buf->col_offset + E.screen_cols)
+    E.buf->col_offset = E.buf->renderer_x - E.screen_cols + 1;
+}
+
+// Switch the color of what follows in AB from highlight class FROM to TO.
+static void
+editor_switch_color (struct abuf *ab, int from, int to)
+{
+  if (from == HL_MATCH)
+    ab_append (ab, "\x1b[27m", 5);
+  if (to == HL_MATCH)
+    ab_append (ab, "\x1b[39;7m", 7);
+  // A match leaves the default color behind.
+  else if (from != HL_MATCH || to != HL_NORMAL)
+    ab_appendf (ab, "\x1b[%dm", syntax_color (to));
+}
+
+// Draw the part of ROW that falls into the screen columns from LEFT on into
+// AB. Colors are only switched where the highlight class changes, and runs
+// of characters that are sent as they are get appended at once.
+static void
+editor_draw_row (struct abuf *ab, const e_row *row, int left)
+{
+  const char *text = row->text;
+  int right = left + E.screen_cols;
+
+  const char *pattern = E.buf->search.pattern.b;
+  int pattern_len = E.buf->search.active ? E.buf->search.pattern.len : 0;
+
+  const unsigned char *highlight = render_cache_highlight (row);
+
+  int col;
+  int i = column_to_byte (text, row->size, render_cache_columns (row), left,
+                          &col);
+
+  // First match that ends after I, including one that started left of the
+  // screen.
+  int match = -1;
+  if (pattern_len)
+    {
+      int from = i - pattern_len + 1;
+      match = search_find (text, row->size, pattern, pattern_len,
+                           from < 0 ? 0 : from);
+    }
+
+  int current = HL_NORMAL;
+  int run = i;
+  while (i < row->size && col < right)
+    {
+      int width;
+      int length = column_char (&text[i], row->size - i, col, &width);
+
+      while (match != -1 && match + pattern_len <= i)
+        match = search_find (text, row->size, pattern, pattern_len,
+                             match + 1);
+
+      int class = highlight ? highlight[i] : HL_NORMAL;
+      if (match != -1 && match <= i)
+        class = HL_MATCH;
+
+      bool clipped = col < left || col + width > right;
+      bool as_is
+          = text[i] != '\t' && !clipped && column_printable (&text[i], length);
+
+      if (class != current || !as_is)
+        {
+          ab_append (ab, &text[run], i - run);
+          run = i;
+        }
+
+      if (class != current)
+        {
+          editor_switch_color (ab, current, class);
+          current = class;
+        }
+
+      if (!as_is)
+        {
+          // Tabs and characters cut by the screen edges become blanks.
+          if (text[i] == '\t' || clipped)
+            {
+              int start = col < left ? left : col;
+              int end = col + width > right ? right : col + width;
+              ab_append_repeat (ab, ' ', end - start);
+            }
+          else
+            ab_append (ab, "?", 1);
+          run = i + length;
+        }
+
+      i += length;
+      col += width;
+    }
+
+  ab_append (ab, &text[run], i - run);
+  // Leave the line in the default color for what follows it.
+  if (current != HL_NORMAL)
+    editor_switch_color (ab, current, HL_NORMAL);
+}
+
+// Rows are drawn into the lines of the next frame, see screen.h
+void
+editor_draw_rows ()
+{
+  int y;
+  // Walk the visible rows in order instead of looking each of them up.
+  // While soft wrapping, LINE is the line of ROW drawn next.
+  int line = 0;
+  e_row *row = row_tree_at (&E.buf->rows, E.buf->row_offset);
+  if (E.soft_wrap)
+    {
+      row = row_tree_at_line (&E.buf->rows, E.buf->line_offset, &line);
+      line = E.buf->line_offset - line;
+    }
+
+  for (y = 0; y < E.screen_rows; y++)
+    {
+      struct abuf *ab = screen_line (y);
+
+      if (row == NULL)
+        {
+          // Welcome mesage
+          if (E.buf->num_rows == 0 && y == (E.screen_rows / 8))
+            {
+              char welcome_buffer[60];
+              int message_length
+                  = snprintf (welcome_buffer, sizeof (welcome_buffer),
+                              "Welcome the the Text Editor ");
+
+              if (message_length > E.screen_cols)
+                message_length = E.screen_cols;
+
+              // Subracting one for first ">" character
+              int spacing = ((E.screen_cols - message_length) / 2) - 1;
+              ab_append (ab, ">", 1);
+              ab_append_repeat (ab, ' ', spacing);
+
+              ab_append (ab, welcome_buffer, message_length);
+            }
+          else
+            {
+              // start of new line ( Should this be replaced with line number
+              // ?)
+              ab_append (ab, ">", 1);
+            }
+        }
+
+      else
+        {
+          editor_render_row (row);
+          if (E.soft_wrap)
+            editor_draw_row (ab, row, line * E.buf->wrap_width);
+          else
+            editor_draw_row (ab, row, E.buf->col_offset);
+
+          if (!E.soft_wrap || ++line == row->lines)
+            {
+              row = row_tree_next (row);
+              line = 0;
+            }
+        }
+    }
+}
+
+// Bytes of the heap in use, row arenas included, -1 if unknown.
+static long long
+editor_heap_bytes ()
+{
+#ifdef HAVE_MALLINFO2
+  struct mallinfo2 info = mallinfo2 ();
+  return info.uordblks + info.hblkhd;
+#else
+  return -1;
+#endif
+}
+
+// Rows held by all buffers.
+static int
+editor_total_rows ()
+{
+  int rows = 0;
+  for (int i = 0; i < E.num_buffers; i++)
+    rows += E.buffers[i]->num_rows;
+  return rows;
+}
+
+void
+editor_draw_status_bar ()
+{
+  struct abuf *ab = screen_line (E.screen_rows);
+  ab_append (ab, "\x1b[7m", 4);
+
+  // A viewed file counts its lines from the start of the file, which are
+  // only known once it is indexed.
+  long long line = E.buf->cursor_y + 1;
+  long long total = E.buf->num_rows;
+  char lines[32];
+  if (E.buf->view.active)
+    {
+      line += E.buf->view.first;
+      total = file_view_lines (&E.buf->view);
+    }
+
+  if (E.buf->loader.active)
+    snprintf (lines, sizeof (lines), "%lld (%d%% loaded)", total,
+              loader_progress (&E.buf->loader));
+  else if (total >= 0)
+    snprintf (lines, sizeof (lines), "%lld", total);
+  else
+    snprintf (lines, sizeof (lines), "? (%d%% indexed)",
+              file_view_progress (&E.buf->view));
+
+  // Number the buffer when there are others.
+  char buffer[32] = "";
+  if (E.num_buffers > 1)
+    snprintf (buffer, sizeof (buffer), "[%d/%d] ", E.current + 1,
+              E.num_buffers);
+
+  // Draw file name in status bar.
+  char status[80], current_row_status[160];
+  int len = snprintf (status, sizeof (status), "%s%.20s - %s lines, %s%s",
+                      buffer,
+                      E.buf->filename ? E.buf->filename : "[untitled]", lines,
+                      E.buf->view.active ? "(read-only)"
+                      : E.buf->modified  ? "(modified)"
+                                         : "",
+                      E.buf->follow.active ? " (following)" : "");
+
+  // Name the file type, if it is highlighted.
+  const char *syntax = E.buf->syntax ? E.buf->syntax->name : "";
+  const char *separator = E.buf->syntax ? " | " : "";
+
+  // The performance overlay takes the room of the file name if need be.
+  int crs_len;
+  if (E.show_stats)
+    {
+      const struct trace_stats *stats = trace_get_stats ();
+      char heap[32] = "";
+      long long heap_bytes = editor_heap_bytes ();
+      if (heap_bytes >= 0)
+        snprintf (heap, sizeof (heap), "heap %.1fMB, ", heap_bytes / 1e6);
+      crs_len = snprintf (
+          current_row_status, sizeof (current_row_status),
+          "key %.2fms | draw %.2fms | %dB/frame | %d syscalls/key | "
+          "%s%d rows | %lld/%s",
+          stats->key_latency_us / 1e3, stats->refresh_us / 1e3,
+          screen_get_stats ()->frame_bytes, stats->key_syscalls, heap,
+          editor_total_rows (), line, total >= 0 ? lines : "?");
+      if (crs_len > E.screen_cols)
+        crs_len = E.screen_cols;
+      if (len > E.screen_cols - crs_len)
+        len = E.screen_cols - crs_len;
+    }
+  else
+    crs_len = snprintf (current_row_status, sizeof (current_row_status),
+                        "%s%s%lld/%s", syntax, separator, line,
+                        total >= 0 ? lines : "?");
+
+  if (len > E.screen_cols)
+    len = E.screen_cols;
+
+  ab_append (ab, status, len);
+
+  // Right align the current row status if it fits.
+  if (E.screen_cols - len >= crs_len)
+    {
+      ab_append_repeat (ab, ' ', E.screen_cols - len - crs_len);
+      ab_append (ab, current_row_status, crs_len);
+    }
+  else
+    ab_append_repeat (ab, ' ', E.screen_cols - len);
+
+  ab_append (ab, "\x1b[m", 3);
+}
+
+// Called with the input of the prompt after every key it gets, KEY being
+// '\r' or ESC once the prompt is accepted or cancelled.
+typedef void (*prompt_callback) (const char *input, int len, int key);
+
+// Line of input read in the message bar, see editor_prompt ().
+static struct
+{
+  const char *label;
+  struct abuf input;
+  prompt_callback callback;
+  bool active;
+  // Column of the cursor at the end of the input.
+  int cursor_x;
+} prompt = { NULL, ABUF_INIT, NULL, false, 0 };
+
+void
+editor_draw_message_bar ()
+{
+  struct abuf *ab = screen_line (E.screen_rows + 1);
+
+  if (prompt.active)
+    {
+      int label_length = strlen (prompt.label);
+      if (label_length > E.screen_cols)
+        label_length = E.screen_cols;
+      ab_append (ab, prompt.label, label_length);
+
+      // Keep the end of a long input in view.
+      const char *input = prompt.input.b;
+      int len = prompt.input.len;
+      int room = E.screen_cols - label_length;
+      int width = column_of_byte (input, len, NULL, len);
+      int skip = 0, col = 0;
+      while (width - col > room)
+        {
+          int w;
+          skip += column_char (&input[skip], len - skip, col, &w);
+          col += w;
+        }
+      ab_append (ab, &input[skip], len - skip);
+      prompt.cursor_x = label_length + width - col;
+      return;
+    }
+
+  int msglen = strlen (E.status_msg);
+  if (msglen > E.screen_cols)
+    msglen = E.screen_cols;
+  if (msglen && time (NULL) - E.status_msg_time < STATUS_MSG_TIMEOUT)
+    ab_append (ab, E.status_msg, msglen);
+}
+
+void
+editor_refresh_screen ()
+{
+  long long start = trace_now_us ();
+  editorScroll ();
+
+  // Rows still in view after a vertical scroll are moved by the terminal,
+  // so that only the ones coming into view are sent. Jumps of a screen or
+  // more and horizontal scrolling repaint the rows instead.
+  // While soft wrapping the view moves by screen lines.
+  static struct buffer *shown = NULL;
+  static bool shown_wrapped;
+  static int shown_top, shown_col_offset;
+  int top = E.soft_wrap ? E.buf->line_offset : E.buf->row_offset;
+  if (E.buf == shown && E.soft_wrap == shown_wrapped
+      && E.buf->col_offset == shown_col_offset)
+    screen_scroll (0, E.screen_rows, top - shown_top);
+  shown = E.buf;
+  shown_wrapped = E.soft_wrap;
+  shown_top = top;
+  shown_col_offset = E.buf->col_offset;
+
+  editor_draw_rows ();
+  editor_draw_status_bar ();
+  editor_draw_message_bar ();
+
+  // Only the lines that changed since the last frame are written out.
+  if (prompt.active)
+    screen_flush (E.screen_rows + 1, prompt.cursor_x);
+  else if (E.soft_wrap)
+    screen_flush (editor_cursor_line () - E.buf->line_offset,
+                  E.buf->renderer_x % E.buf->wrap_width);
+  else
+    screen_flush (E.buf->cursor_y - E.buf->row_offset,
+                  E.buf->renderer_x - E.buf->col_offset);
+
+  trace_frame (start, screen_get_stats ()->frame_bytes);
+  if (trace_active ())
+    {
+      long long heap_bytes = editor_heap_bytes ();
+      if (heap_bytes >= 0)
+        trace_counter ("memory", "\"heap\":%lld,\"rows\":%d", heap_bytes,
+                       editor_total_rows ());
+      else
+        trace_counter ("memory", "\"rows\":%d", editor_total_rows ());
+    }
+}
+
+/* Set the status message that would be displyed in the message bar.  */
+void
+editor_set_status_message (const char *fmt, ...)
+{
+  va_list ap;
+  va_start (ap, fmt);
+  vsnprintf (E.status_msg, sizeof (E.status_msg), fmt, ap);
+  va_end (ap);
+  E.status_msg_time = time (NULL);
+}
+
+// Milliseconds until the screen has to be redrawn without any input, -1 if
+// nothing is pending. The message bar is the only timed content, and 0 is
+// returned while there is work left in the background.
+int
+editor_next_timeout ()
+{
+  if (E.buf->view.active && file_view_lines (&E.buf->view) < 0)
+    return 0;
+
+  // Journaled edits are written out in the background too, and a followed
+  // file may have to be looked at.
+  int timeout = swap_timeout (&E.buf->swap);
+  int follow = follow_timeout (&E.buf->follow);
+  if (follow != -1 && (timeout == -1 || follow < timeout))
+    timeout = follow;
+
+  if (E.status_msg[0] == '\0')
+    return timeout;
+
+  time_t left = E.status_msg_time + STATUS_MSG_TIMEOUT - time (NULL);
+  if (left > 0 && (timeout == -1 || left * 1000 < timeout))
+    timeout = left * 1000;
+  return timeout;
+}
+
+// Work left to do in the background, see editor_background_step ().
+static bool
+editor_background_work ()
+{
+  switch (follow_poll (&E.buf->follow))
+    {
+    case FOLLOW_NONE:
+      break;
+    case FOLLOW_GROWN:
+      editor_follow_grown ();
+      break;
+    case FOLLOW_REPLACED:
+      editor_follow_reopen ();
+      break;
+    }
+
+  if (E.buf->loader.active)
+    editor_load_merge (false);
 
-  if (E.cursor_y >= E.row_offset + E.screen_rows)
-    E.row_offset = E.cursor_y - E.screen_rows + 1;
+  if (E.buf->map_truncated)
+    {
+      editor_map_detach ();
+      editor_set_status_message ("File was truncated, lines past its new end "
+                                 "are lost");
+    }
 
-  if (E.renderer_x < E.col_offset)
-    E.col_offset = E.renderer_x;
+  if (swap_timeout (&E.buf->swap) == 0 && !swap_flush (&E.buf->swap))
+    editor_set_status_message ("Can't write swap file ! %s, changes are "
+                               "not journaled",
+                               strerror (errno));
 
-  if (E.renderer_x >= E.col_offset + E.screen_cols)
-    E.col_offset = E.renderer_x - E.screen_cols + 1;
+  if (E.buf->view.active)
+    return file_view_index_step (&E.buf->view);
+
+  return E.buf->loader.active;
 }
 
-// using append buffer to paint to prevent flickring while typing
-void
-editor_draw_rows (struct abuf *ab)
+bool
+editor_background_step ()
 {
-  int y;
-  for (y = 0; y < E.screen_rows; y++)
-    {
-      int filerow = y + E.row_offset;
-      if (filerow >= E.num_rows)
-        {
-          // Welcome mesage
-          if (E.num_rows == 0 && y == (E.screen_rows / 8))
-            {
-              char welcome_buffer[60];
-              int message_length
-                  = snprintf (welcome_buffer, sizeof (welcome_buffer),
-                              "Welcome the the Text Editor ");
+  long long start = trace_now_us ();
+  bool more = editor_background_work ();
+  trace_span ("background", start, NULL);
+  return more;
+}
 
-              if (message_length > E.screen_cols)
-                message_length = E.screen_cols;
+/************************ input ***********************/
 
-              // Subracting one for first ">" character
-              int spacing = ((E.screen_cols - message_length) / 2) - 1;
-              ab_append (ab, ">", 1);
-              for (int i = 0; i < spacing; ++i)
-                {
-                  ab_append (ab, " ", 1);
-                }
+// Open a prompt in the message bar that shows LABEL followed by the input,
+// which starts out as the LEN bytes of INITIAL. Keys go to the prompt until
+// it is closed with Enter or ESC.
+static void
+editor_prompt (const char *label, const char *initial, int len,
+               prompt_callback callback)
+{
+  prompt.label = label;
+  ab_reset (&prompt.input);
+  ab_append (&prompt.input, initial, len);
+  prompt.callback = callback;
+  prompt.active = true;
+}
 
-              ab_append (ab, welcome_buffer, message_length);
-            }
-          else
-            {
-              // start of new line ( Should this be replaced with line number
-              // ?)
-              ab_append (ab, ">", 1);
-            }
-        }
+static void
+editor_prompt_key (int key)
+{
+  switch (key)
+    {
+    case '\r':
+    case '\x1b':
+      prompt.active = false;
+      break;
 
-      else
+    case BACKSPACE:
+    case CTRL_KEY ('h'):
+    case DEL_KEY:
+      prompt.input.len = column_prev_char (prompt.input.b, prompt.input.len,
+                                           prompt.input.len);
+      break;
+
+    // Only the first line of a paste fits into the prompt.
+    case PASTE_KEY:
+      ab_append (&prompt.input, paste.b,
+                 editor_line_length (paste.b, paste.len));
+      break;
+
+    default:
+      // Bytes of UTF-8 characters come in as negative chars.
+      if (key < 0 || (key < 128 && !iscntrl (key)))
         {
-          int len = E.row[filerow].r_size - E.col_offset;
+          char c = key;
+          ab_append (&prompt.input, &c, 1);
+        }
+    }
 
-          if (len < 0)
-            len = 0;
+  prompt.callback (prompt.input.b, prompt.input.len, key);
+}
 
-          if (len > E.screen_cols)
-            len = E.screen_cols;
+// Cursor and scroll position to return to when a search is cancelled.
+static struct
+{
+  int cursor_y, cursor_x;
+  int row_offset, col_offset;
+} find_origin;
 
-          ab_append (ab, &E.row[filerow].renderer[E.col_offset], len);
+static void
+editor_find_callback (const char *pattern, int len, int key)
+{
+  if (key == '\r' || key == '\x1b')
+    {
+      E.buf->search.active = false;
+      if (key == '\x1b')
+        {
+          E.buf->cursor_y = find_origin.cursor_y;
+          E.buf->cursor_x = find_origin.cursor_x;
+          E.buf->row_offset = find_origin.row_offset;
+          E.buf->col_offset = find_origin.col_offset;
         }
+      return;
+    }
+
+  // Arrows step through the matches, anything else edits the pattern
+  // which is then looked up again from where the search started.
+  bool backward = key == ARROW_LEFT || key == ARROW_UP;
+  bool step = backward || key == ARROW_RIGHT || key == ARROW_DOWN;
+
+  int y = find_origin.cursor_y;
+  int x = find_origin.cursor_x;
+  if (step)
+    {
+      y = E.buf->cursor_y;
+      x = backward ? E.buf->cursor_x : E.buf->cursor_x + 1;
+    }
+  else
+    search_set_pattern (&E.buf->search, pattern, len);
 
-      // Clear "in line"
-      ab_append (ab, "\x1b[K", 3);
-      ab_append (ab, "\r\n", 2);
+  const struct search_match *match
+      = search_next (&E.buf->search, &E.buf->rows, y, x, backward);
+  if (match)
+    {
+      E.buf->cursor_y = match->y;
+      E.buf->cursor_x = match->x;
+    }
+  else if (!step)
+    {
+      E.buf->cursor_y = find_origin.cursor_y;
+      E.buf->cursor_x = find_origin.cursor_x;
     }
 }
 
+// Search incrementally as the pattern is typed, starting with the last one.
 void
-editor_draw_status_bar (struct abuf *ab)
+editor_find ()
 {
-  ab_append (ab, "\x1b[7m", 4);
+  find_origin.cursor_y = E.buf->cursor_y;
+  find_origin.cursor_x = E.buf->cursor_x;
+  find_origin.row_offset = E.buf->row_offset;
+  find_origin.col_offset = E.buf->col_offset;
+
+  E.buf->search.active = true;
+  editor_prompt ("Search (ESC/Arrows/Enter): ", E.buf->search.pattern.b,
+                 E.buf->search.pattern.len, editor_find_callback);
+}
 
-  // Draw file name in status bar.
-  char status[80], current_row_status[80];
-  int len = snprintf (status, sizeof (status), "%.20s - %d lines, %s",
-                      E.filename ? E.filename : "[untitled]", E.num_rows,
-                      E.modified ? "(modified)" : "");
+// Text to replace, kept while what replaces it is asked for.
+static struct abuf replace_pattern = ABUF_INIT;
 
-  int crs_len = snprintf (current_row_status, sizeof (current_row_status),
-                          "%d/%d", E.cursor_y + 1, E.num_rows);
+static void
+editor_replace_with_callback (const char *with, int len, int key)
+{
+  if (key != '\r')
+    return;
 
-  if (len > E.screen_cols)
-    len = E.screen_cols;
+  int count = editor_replace_all (replace_pattern.b, replace_pattern.len,
+                                  with, len);
+  editor_set_status_message ("Replaced %d occurrence(s)", count);
+}
 
-  ab_append (ab, status, len);
+static void
+editor_replace_callback (const char *pattern, int len, int key)
+{
+  if (key != '\r' || len == 0)
+    return;
+
+  ab_reset (&replace_pattern);
+  ab_append (&replace_pattern, pattern, len);
+  editor_prompt ("Replace with: ", NULL, 0, editor_replace_with_callback);
+}
+
+// Indent the run of non-empty rows around the cursor, or outdent it.
+static void
+editor_indent_block (bool outdent)
+{
+  e_row *row = row_tree_at (&E.buf->rows, E.buf->cursor_y);
+  if (row == NULL)
+    return;
+
+  int from = E.buf->cursor_y;
+  int to = E.buf->cursor_y;
+  for (e_row *prev = row_tree_prev (row); prev && prev->size > 0;
+       prev = row_tree_prev (prev))
+    from--;
+  for (e_row *next = row_tree_next (row); next && next->size > 0;
+       next = row_tree_next (next))
+    to++;
+
+  editor_indent_rows (from, to, outdent);
+}
 
-  for (int i = len; i < E.screen_cols; i++)
+// Redo an edit read back from the swap file.
+static void
+editor_replay (enum undo_kind kind, int y, int x, const char *text,
+               long long len)
+{
+  // The rows of a save in place take the place of whatever the file holds
+  // from row Y on, see editor_journal_tail ().
+  if (kind == SWAP_TAIL)
     {
-      if (E.screen_cols - i == crs_len)
+      while (E.buf->num_rows > y)
+        editor_delete_row (E.buf->num_rows - 1);
+
+      const char *end = text + len;
+      while (text < end)
         {
-          ab_append (ab, current_row_status, crs_len);
-          break;
+          const char *newline = memchr (text, '\n', end - text);
+          int length = (newline ? newline : end) - text;
+          editor_insert_row (E.buf->num_rows, (char *)text, length);
+          text += length + 1;
         }
-      else
-        ab_append (ab, " ", 1);
+      return;
     }
 
-  ab_append (ab, "\x1b[m", 3);
-  // Space for message bar.
-  ab_append (ab, "\r\n", 2);
+  e_row *row = row_tree_at (&E.buf->rows, y);
+
+  switch (kind)
+    {
+    case UNDO_INSERT:
+      if (row)
+        editor_row_insert_string (row, x, text, len);
+      break;
+    case UNDO_DELETE:
+      if (row)
+        editor_row_delete_string (row, x, len);
+      break;
+    case UNDO_INSERT_ROW:
+      editor_insert_row (y, (char *)text, len);
+      break;
+    case UNDO_DELETE_ROW:
+      editor_delete_row (y);
+      break;
+    }
 }
 
-void
-editor_draw_message_bar (struct abuf *ab)
+static void
+editor_recover_callback (const char *answer, int len, int key)
 {
-  ab_append (ab, "\x1b[K", 3);
-  int msglen = strlen (E.status_msg);
-  if (msglen > E.screen_cols)
-    msglen = E.screen_cols;
-  if (msglen && time (NULL) - E.status_msg_time < 5)
-    ab_append (ab, E.status_msg, msglen);
+  if (key != '\r')
+    return;
+
+  if (len > 0 && (answer[0] == 'y' || answer[0] == 'Y'))
+    {
+      // Recovered edits are not undone one by one.
+      editor_begin_edit ();
+      undo_suspend (&E.buf->undo);
+      int count = swap_replay (&E.buf->swap, editor_replay);
+      undo_resume (&E.buf->undo);
+      editor_commit_edit ();
+      editor_set_status_message ("Recovered %d changes", count);
+    }
 }
 
-void
-editor_refresh_screen ()
+// Offer the recovery found for the buffer shown, unless a prompt is open
+// already. It is then offered when the buffer is shown again.
+static void
+editor_prompt_recovery ()
 {
-  editorScroll ();
+  if (!E.buf->recovery_pending || prompt.active)
+    return;
+
+  E.buf->recovery_pending = false;
+  editor_prompt ("Recover unsaved changes from the swap file? (y/n) ", NULL,
+                 0, editor_recover_callback);
+}
+
+// Journal the edits to the opened file from now on, after offering to
+// recover the ones a crashed session left in its swap file. Declining
+// leaves the swap file alone until the first edit replaces it.
+static void
+editor_offer_recovery ()
+{
+  swap_open (&E.buf->swap, E.buf->filename);
+  E.buf->recovery_pending = swap_recoverable (&E.buf->swap);
+  editor_prompt_recovery ();
+}
 
-  struct abuf ab = ABUF_INIT;
+void
+editor_goto_line (long long line)
+{
+  if (E.buf->view.active)
+    {
+      // Lines outside the window are loaded, a line past the end of the
+      // file has had it indexed to the end.
+      if (line < E.buf->view.first
+          || line >= E.buf->view.first + E.buf->num_rows)
+        if (!editor_view_load (line))
+          {
+            line = file_view_lines (&E.buf->view) - 1;
+            editor_view_load (line);
+          }
+      line -= E.buf->view.first;
+    }
+  else if (line >= E.buf->num_rows)
+    line = E.buf->num_rows > 0 ? E.buf->num_rows - 1 : 0;
 
-  // Hide the cursor while typing
-  ab_append (&ab, "\x1b[?25l", 6);
-  ab_append (&ab, "\x1b[H", 3);
+  E.buf->cursor_y = line;
+  E.buf->cursor_x = 0;
 
-  editor_draw_rows (&ab);
-  editor_draw_status_bar (&ab);
-  editor_draw_message_bar (&ab);
+  // Show the line in the middle of the screen.
+  E.buf->row_offset = E.buf->cursor_y - E.screen_rows / 2;
+  if (E.buf->row_offset < 0)
+    E.buf->row_offset = 0;
+}
 
-  char cursor_buff[32];
-  int len = snprintf (cursor_buff, 32, "\x1b[%d;%dH",
-                      (E.cursor_y - E.row_offset) + 1,
-                      (E.renderer_x - E.col_offset) + 1);
+static void
+editor_goto_callback (const char *input, int len, int key)
+{
+  if (key != '\r')
+    return;
 
-  ab_append (&ab, cursor_buff, len);
+  char number[32];
+  snprintf (number, sizeof (number), "%.*s", len, input);
 
-  ab_append (&ab, "\x1b[?25h", 6);
+  char *end;
+  long long line = strtoll (number, &end, 10);
+  if (end == number || *end != '\0' || line < 1)
+    {
+      editor_set_status_message ("Not a line number: %s", number);
+      return;
+    }
 
-  write (STDOUT_FILENO, ab.b, ab.len);
-  ab_free (&ab);
+  editor_goto_line (line - 1);
 }
 
-/* Set the status message that would be displyed in the message bar.  */
-void
-editor_set_status_message (const char *fmt, ...)
+// Move the cursor up or down by screen lines while soft wrapping, it keeps
+// its column on the line. Paging goes to the edge of the screen and a
+// screen further.
+static void
+editor_navigate_wrapped (int key)
 {
-  va_list ap;
-  va_start (ap, fmt);
-  vsnprintf (E.status_msg, sizeof (E.status_msg), fmt, ap);
-  va_end (ap);
-  E.status_msg_time = time (NULL);
-}
+  editor_wrap_update ();
+  int width = E.buf->wrap_width;
+
+  e_row *row = row_tree_at (&E.buf->rows, E.buf->cursor_y);
+  int rx = row ? editor_convert_cx_to_rx (row, E.buf->cursor_x) : 0;
+  int line = row ? row_tree_line_of (row) + rx / width
+                 : row_tree_lines (&E.buf->rows);
+
+  if (key == ARROW_UP)
+    line--;
+  else if (key == ARROW_DOWN)
+    line++;
+  else if (key == PAGE_UP)
+    line = E.buf->line_offset - E.screen_rows;
+  else
+    line = E.buf->line_offset + 2 * E.screen_rows - 1;
 
-/************************ input ***********************/
+  if (line < 0)
+    line = 0;
+
+  int first;
+  row = row_tree_at_line (&E.buf->rows, line, &first);
+  if (row == NULL)
+    {
+      E.buf->cursor_y = E.buf->num_rows;
+      E.buf->cursor_x = 0;
+      return;
+    }
+
+  E.buf->cursor_y = row_tree_index_of (row);
+  E.buf->cursor_x
+      = editor_convert_rx_to_cx (row, (line - first) * width + rx % width);
+}
 
 void
 editor_navigate_cursor (int key)
 {
-  e_row *row = (E.cursor_y >= E.num_rows) ? NULL : &E.row[E.cursor_y];
+  e_row *row = row_tree_at (&E.buf->rows, E.buf->cursor_y);
 
   // navigating via wasd
   switch (key)
     {
     case ARROW_LEFT:
-      if (E.cursor_x != 0)
-        E.cursor_x--;
+      if (E.buf->cursor_x != 0)
+        E.buf->cursor_x
+            = column_prev_char (row->text, row->size, E.buf->cursor_x);
       // left arrow at the end of line
-      else if (E.cursor_y > 0)
+      else if (E.buf->cursor_y > 0)
         {
-          E.cursor_y--;
-          E.cursor_x = E.row[E.cursor_y].size;
+          E.buf->cursor_y--;
+          E.buf->cursor_x = row_tree_at (&E.buf->rows, E.buf->cursor_y)->size;
         }
       break;
 
     case ARROW_RIGHT:
-      if (row && E.cursor_x < row->size)
-        E.cursor_x++;
+      if (row && E.buf->cursor_x < row->size)
+        {
+          int width;
+          E.buf->cursor_x += column_char (&row->text[E.buf->cursor_x],
+                                          row->size - E.buf->cursor_x, 0,
+                                          &width);
+        }
       // right arrow on begining of line
-      else if (row && E.cursor_x == row->size)
+      else if (row && E.buf->cursor_x == row->size)
         {
-          E.cursor_y++;
-          E.cursor_x = 0;
+          E.buf->cursor_y++;
+          E.buf->cursor_x = 0;
         }
       break;
 
-    case ARROW_UP:
-      if (E.cursor_y != 0)
-        E.cursor_y--;
+    case HOME_KEY:
+      E.buf->cursor_x = 0;
       break;
 
+    case END_KEY:
+      E.buf->cursor_x = row ? row->size : 0;
+      break;
+
+    // Moving between rows keeps the screen column, not the byte. Paging
+    // goes to the edge of the screen and a screen further.
+    case ARROW_UP:
     case ARROW_DOWN:
-      if (E.cursor_y < E.num_rows)
-        E.cursor_y++;
+    case PAGE_UP:
+    case PAGE_DOWN:
+      if (E.soft_wrap)
+        {
+          editor_navigate_wrapped (key);
+          break;
+        }
+      {
+        int rx = row ? editor_convert_cx_to_rx (row, E.buf->cursor_x) : 0;
+        if (key == ARROW_UP)
+          E.buf->cursor_y--;
+        else if (key == ARROW_DOWN)
+          E.buf->cursor_y++;
+        else if (key == PAGE_UP)
+          E.buf->cursor_y = E.buf->row_offset - E.screen_rows;
+        else
+          E.buf->cursor_y = E.buf->row_offset + 2 * E.screen_rows - 1;
+
+        if (E.buf->cursor_y < 0)
+          E.buf->cursor_y = 0;
+        if (E.buf->cursor_y > E.buf->num_rows)
+          E.buf->cursor_y = E.buf->num_rows;
+
+        row = row_tree_at (&E.buf->rows, E.buf->cursor_y);
+        E.buf->cursor_x = row ? editor_convert_rx_to_cx (row, rx) : 0;
+      }
       break;
     }
 
   // Clip cursor at the end of lines
-  row = (E.cursor_y >= E.num_rows) ? NULL : &E.row[E.cursor_y];
+  row = row_tree_at (&E.buf->rows, E.buf->cursor_y);
   int rowlen = row ? row->size : 0;
-  if (E.cursor_x > rowlen)
-    E.cursor_y = rowlen;
+  if (E.buf->cursor_x > rowlen)
+    E.buf->cursor_x = rowlen;
 }
 
-void
-editor_process_keypress ()
+// Number of buffers with unsaved changes.
+static int
+editor_modified_buffers ()
+{
+  int count = 0;
+  for (int i = 0; i < E.num_buffers; i++)
+    if (E.buffers[i]->modified)
+      count++;
+  return count;
+}
+
+static void
+editor_handle_key (int c)
 {
   static int quit_attempts = 0;
-  int c = editor_read_key ();
+
+  // Keys belong to the prompt while one is open.
+  if (prompt.active)
+    {
+      editor_prompt_key (c);
+      return;
+    }
+
+  // Until the file is loaded, keys can move around the rows loaded so far.
+  // Anything else waits for the rest first.
+  if (E.buf->loader.active)
+    switch (c)
+      {
+      case CTRL_KEY ('q'):
+      case CTRL_KEY ('t'):
+      case CTRL_KEY ('e'):
+      case CTRL_KEY ('n'):
+      case CTRL_KEY ('p'):
+      case ARROW_LEFT:
+      case ARROW_RIGHT:
+      case ARROW_DOWN:
+      case ARROW_UP:
+      case HOME_KEY:
+      case END_KEY:
+      case PAGE_UP:
+      case PAGE_DOWN:
+        break;
+
+      default:
+        editor_load_wait ();
+        break;
+      }
+
+  // A viewed file is read-only, its window follows the cursor.
+  if (E.buf->view.active)
+    {
+      editor_view_follow ();
+      switch (c)
+        {
+        case CTRL_KEY ('q'):
+        case CTRL_KEY ('t'):
+        case CTRL_KEY ('e'):
+        case CTRL_KEY ('g'):
+        case CTRL_KEY ('w'):
+        case CTRL_KEY ('n'):
+        case CTRL_KEY ('p'):
+        case ARROW_LEFT:
+        case ARROW_RIGHT:
+        case ARROW_DOWN:
+        case ARROW_UP:
+        case HOME_KEY:
+        case END_KEY:
+        case PAGE_UP:
+        case PAGE_DOWN:
+          break;
+
+        default:
+          editor_read_only ();
+          return;
+        }
+    }
+
+  // Everything one key press changes is undone in one step.
+  undo_begin_group (&E.buf->undo);
 
   switch (c)
     {
     // "ctrl + q" to quit
     case CTRL_KEY ('q'):
-      if (E.modified && quit_attempts < 1)
+      if (editor_modified_buffers () > 0 && quit_attempts < 1)
         {
-          editor_set_status_message ("File contains unsaved changes,"
-                                     "Press CTRL-Q again to confirm quit.");
+          editor_set_status_message ("%d file(s) contain unsaved changes, "
+                                     "Press CTRL-Q again to confirm quit.",
+                                     editor_modified_buffers ());
           quit_attempts++;
           break;
         }
-      write (STDOUT_FILENO, "\x1b[2J", 4);
-      write (STDOUT_FILENO, "\x1b[H", 3);
+      // Unsaved changes are dropped on purpose, not to be recovered.
+      for (int i = 0; i < E.num_buffers; i++)
+        swap_discard (&E.buffers[i]->swap);
+      screen_clear ();
       exit (0);
       break;
 
+    // "ctrl + n" and "ctrl + p" show the next and the previous buffer
+    case CTRL_KEY ('n'):
+      editor_switch_buffer (E.current + 1);
+      break;
+
+    case CTRL_KEY ('p'):
+      editor_switch_buffer (E.current - 1);
+      break;
+
     // "ctrl + s" to save the buffer to disk
     case CTRL_KEY ('s'):
-      {
-        bool save_sucess = editor_save ();
+      // editor_save () reports the outcome in the message bar itself.
+      if (editor_save ())
+        E.buf->modified = 0;
+      break;
 
-        if (save_sucess)
-          {
-            editor_set_status_message ("save succesfull !");
-            E.modified = 0;
-          }
-        // TODO: Give out more info about what went wrong while saving.
-        else
-          editor_set_status_message ("Can't save !");
-        break;
-      }
+    // "ctrl + t" to toggle frame statistics in the status bar
+    case CTRL_KEY ('t'):
+      E.show_stats = !E.show_stats;
+      break;
+
+    // "ctrl + e" to toggle wrapping long lines onto the lines below
+    case CTRL_KEY ('e'):
+      E.soft_wrap = !E.soft_wrap;
+      break;
 
-    // Navigation keys
+    // "ctrl + f" to search
+    case CTRL_KEY ('f'):
+      undo_break (&E.buf->undo);
+      editor_find ();
+      break;
+
+    // "ctrl + z" to undo and "ctrl + y" to redo the last change
+    case CTRL_KEY ('z'):
+      editor_undo ();
+      break;
+
+    case CTRL_KEY ('y'):
+      editor_redo ();
+      break;
+
+    // "ctrl + w" to follow what gets appended to the file
+    case CTRL_KEY ('w'):
+      undo_break (&E.buf->undo);
+      editor_follow (!E.buf->follow.active);
+      break;
+
+    // "ctrl + g" to go to a line
+    case CTRL_KEY ('g'):
+      undo_break (&E.buf->undo);
+      editor_prompt ("Go to line: ", NULL, 0, editor_goto_callback);
+      break;
+
+    // "ctrl + r" to replace every occurrence of a text
+    case CTRL_KEY ('r'):
+      undo_break (&E.buf->undo);
+      editor_prompt ("Replace: ", E.buf->search.pattern.b,
+                     E.buf->search.pattern.len, editor_replace_callback);
+      break;
+
+    // "ctrl + ]" and "shift + tab" to indent and outdent the block of
+    // lines around the cursor
+    case CTRL_KEY (']'):
+    case SHIFT_TAB:
+      editor_indent_block (c == SHIFT_TAB);
+      break;
+
+    // Navigation keys, typing elsewhere starts a new undo step.
     case ARROW_LEFT:
     case ARROW_RIGHT:
     case ARROW_DOWN:
     case ARROW_UP:
+    case HOME_KEY:
+    case END_KEY:
+    case PAGE_UP:
+    case PAGE_DOWN:
+      undo_break (&E.buf->undo);
       editor_navigate_cursor (c);
       break;
 
@@ -647,6 +3159,11 @@ editor_process_keypress ()
       editor_insert_newline ();
       break;
 
+    // Bracketed paste, inserted as a whole
+    case PASTE_KEY:
+      editor_insert_text (paste.b, paste.len);
+      break;
+
     // Deletion keys
     case BACKSPACE:
     case CTRL_KEY ('h'):
@@ -664,24 +3181,124 @@ editor_process_keypress ()
     }
 }
 
+void
+editor_process_keypress ()
+{
+  int c = editor_read_key ();
+
+  long long start = trace_now_us ();
+  trace_key ();
+  editor_handle_key (c);
+  trace_span ("key", start, "\"key\":%d", c);
+}
+
+/************************ buffers ***********************/
+
+static void
+editor_init_buffer (struct buffer *buf)
+{
+  buf->cursor_x = 0;
+  buf->cursor_y = 0;
+  buf->renderer_x = 0;
+  buf->num_rows = 0;
+  buf->row_offset = 0;
+  buf->col_offset = 0;
+  buf->line_offset = 0;
+  buf->wrap_width = 0;
+  buf->arena = (struct row_arena)ROW_ARENA_INIT;
+  buf->rows = (struct row_tree)ROW_TREE_INIT (&buf->arena);
+  buf->undo = (struct undo_journal)UNDO_JOURNAL_INIT (UNDO_MEMORY_LIMIT);
+  buf->swap = (struct swap)SWAP_INIT;
+  buf->recovery_pending = false;
+  buf->search = (struct search)SEARCH_INIT;
+  buf->map = NULL;
+  buf->map_size = 0;
+  buf->view = (struct file_view)FILE_VIEW_INIT;
+  buf->view_appended = 0;
+  buf->loader = (struct loader)LOADER_INIT;
+  buf->file_size = 0;
+  buf->follow = (struct follow)FOLLOW_INIT;
+  buf->filename = NULL;
+  buf->syntax = NULL;
+  buf->syntax_rows = 0;
+  buf->modified = 0;
+  buf->save_from = 0;
+  memset (&buf->saved, 0, sizeof (buf->saved));
+  buf->map_on_disk = false;
+  buf->map_truncated = false;
+}
+
+void
+editor_new_buffer ()
+{
+  struct buffer **buffers
+      = realloc (E.buffers, (E.num_buffers + 1) * sizeof (struct buffer *));
+  struct buffer *buf = malloc (sizeof (struct buffer));
+  if (buffers == NULL || buf == NULL)
+    die ("malloc");
+
+  // Buffers never move, the loader and the row tree point into them.
+  editor_init_buffer (buf);
+  E.buffers = buffers;
+  E.buffers[E.num_buffers] = buf;
+  E.current = E.num_buffers++;
+  E.buf = buf;
+}
+
+void
+editor_switch_buffer (int index)
+{
+  index %= E.num_buffers;
+  if (index < 0)
+    index += E.num_buffers;
+
+  // Only the buffer shown has its journal written out on time, the one
+  // left has it written now.
+  if (!swap_flush (&E.buf->swap))
+    editor_set_status_message ("Can't write swap file ! %s, changes are "
+                               "not journaled",
+                               strerror (errno));
+
+  // Everything else stays as it was, rows are drawn from the text.
+  E.current = index;
+  E.buf = E.buffers[index];
+  editor_prompt_recovery ();
+}
+
 /************************** init *************************/
 void
-init_editor ()
+editor_set_screen_size (int rows, int cols)
+{
+  // Leave space for status bar.
+  E.screen_rows = rows - 2;
+  if (E.screen_rows < 1)
+    E.screen_rows = 1;
+  E.screen_cols = cols;
+
+  render_cache_reserve (E.screen_rows * 2);
+  screen_resize (E.screen_rows + 2, E.screen_cols);
+}
+
+void
+editor_handle_resize ()
 {
-  if (get_windows_size (&E.screen_rows, &E.screen_cols) == -1)
+  int rows, cols;
+  if (get_windows_size (&rows, &cols) == -1)
     die ("get_windows_size");
 
-  E.cursor_x = 0;
-  E.cursor_y = 0;
-  E.renderer_x = 0;
-  E.num_rows = 0;
-  E.row_offset = 0;
-  E.col_offset = 0;
-  E.row = NULL;
-  E.filename = NULL;
+  editor_set_screen_size (rows, cols);
+}
+
+void
+init_editor ()
+{
+  E.buffers = NULL;
+  E.num_buffers = 0;
+  E.current = 0;
+  editor_new_buffer ();
   E.status_msg[0] = '\0';
   E.status_msg_time = 0;
-  E.modified = 0;
-  // Leave space for status bar.
-  E.screen_rows -= 2;
+  E.show_stats = false;
+  E.soft_wrap = false;
+  editor_watch_truncation ();
 }
@@ -2,15 +2,50 @@
 #define EDITOR_H
 
 #include "abuf.h"
+#include "columns.h"
+#include "file_view.h"
+#include "follow.h"
+#include "loader.h"
+#include "row_tree.h"
+#include "search.h"
+#include "swap.h"
+#include "syntax.h"
+#include "undo.h"
 
 #include <stdbool.h>
+#include <sys/stat.h>
 #include <termios.h>
 #include <time.h>
 
 // Mask to imitate a CTRL key press on keyboard.
 #define CTRL_KEY(k) ((k)&0x1f)
 
-#define TAB_SIZE 4
+// Number of rows handed to a single writev () while saving.
+#define SAVE_BATCH_ROWS 512
+// Rows shorter than SAVE_STAGE_ROW bytes are copied together into a buffer
+// of SAVE_STAGE_BYTES instead, rather than written as pieces of their own.
+#define SAVE_STAGE_ROW 128
+#define SAVE_STAGE_BYTES (64 * 1024)
+// Flush saved files to disk before they replace the original.
+#define SAVE_FSYNC true
+
+// Bytes of terminal input read at once.
+#define INPUT_BUFFER_SIZE 4096
+// Milliseconds to wait for the rest of an escape sequence.
+#define ESC_TIMEOUT_MS 100
+// Milliseconds of silence after which an unterminated paste is dropped.
+#define PASTE_TIMEOUT_MS 1000
+// Seconds a status message stays visible.
+#define STATUS_MSG_TIMEOUT 5
+
+// Bytes of history kept for undo before the oldest steps are dropped.
+#define UNDO_MEMORY_LIMIT (64 * 1024 * 1024)
+
+// Files of at least this many bytes are viewed read-only a window at a time
+// instead of being loaded, see file_view.h
+#ifndef VIEW_MIN_SIZE
+#define VIEW_MIN_SIZE (512LL * 1024 * 1024)
+#endif
 
 enum key
 {
@@ -24,28 +59,83 @@ enum key
   END_KEY,
   PAGE_UP,
   PAGE_DOWN,
+  SHIFT_TAB,
+  // A bracketed paste was read as a whole.
+  PASTE_KEY,
 };
 
-typedef struct editor_row
-{
-  int size;
-  char *text;
-  int r_size;
-  char *renderer;
-} e_row;
-
-struct editor_config
+// An open document. Each one keeps its rows, history and position while
+// another is shown, so switching between them is only a matter of pointing
+// E.buf at it.
+struct buffer
 {
   int cursor_x, cursor_y;
   int renderer_x;
-  int screen_rows;
-  int screen_cols;
   int num_rows;
   int row_offset;
   int col_offset;
-  e_row *row;
+  // Screen line at the top of the screen while soft wrapping, and the
+  // width the lines of the rows are counted for, 0 while they are not.
+  int line_offset;
+  int wrap_width;
+  struct row_tree rows;
+  // Owns the tree nodes and the text of the rows.
+  struct row_arena arena;
+  struct undo_journal undo;
+  // Edits not saved yet, journaled for crash recovery.
+  struct swap swap;
+  // A swap file to recover from was found, the offer is made once the
+  // buffer is shown.
+  bool recovery_pending;
+  struct search search;
+  // Read-only mapping of the opened file that unedited rows point into.
+  char *map;
+  size_t map_size;
+  // Set up instead of the above for files too large to load, the rows are
+  // then the lines of its window, to which VIEW_APPENDED bytes were added
+  // by following the file.
+  struct file_view view;
+  size_t view_appended;
+  // Loads the rows of a mapped file in the background, see loader.h
+  struct loader loader;
+  // Bytes of the file the rows hold, kept up to date while the file is
+  // followed for what gets appended to it.
+  off_t file_size;
+  struct follow follow;
   bool modified;
+  // Rows from SAVE_FROM on may differ from the file, which holds the rows
+  // above as a save writes them, so the next save rewrites it from there
+  // on. That is only if SAVED, what the file looked like when it was
+  // loaded or saved last, still describes it.
+  int save_from;
+  struct stat saved;
+  // The mapping is of the file as it is on disk, rows that point into it
+  // change if the file is written in place.
+  bool map_on_disk;
+  // The file was cut short under the mapping, which now reads as zeros
+  // past its end, see editor_map_detach ().
+  bool map_truncated;
   char *filename;
+  // Highlighting rules of the file type, NULL if not highlighted.
+  const struct syntax *syntax;
+  // Number of leading rows whose lexer state is up to date.
+  int syntax_rows;
+};
+
+struct editor_config
+{
+  // The open documents and the one shown, BUFFERS[CURRENT].
+  struct buffer **buffers;
+  int num_buffers;
+  int current;
+  struct buffer *buf;
+  int screen_rows;
+  int screen_cols;
+  // Show bytes written per frame in the status bar.
+  bool show_stats;
+  // Wrap rows wider than the screen onto the lines below it instead of
+  // scrolling sideways.
+  bool soft_wrap;
   char status_msg[80];
   time_t status_msg_time;
   struct termios orig_termios;
@@ -55,11 +145,26 @@ extern struct editor_config E;
 
 int editor_read_key ();
 
+bool editor_input_pending ();
+
+// Read keys from FD instead of the terminal.
+void editor_set_input (int fd);
+
+// Wait up to TIMEOUT milliseconds for input, false if none arrived or the
+// input has ended.
+bool editor_input_wait (int timeout);
+
 /************************ row operations ********************/
 
 int editor_convert_cx_to_rx (e_row *row, const int cx);
 
-void editor_update_row (e_row *row);
+int editor_convert_rx_to_cx (e_row *row, const int rx);
+
+void editor_render_row (e_row *row);
+
+void editor_invalidate_row (e_row *row);
+
+void editor_row_own (e_row *row);
 
 void editor_insert_row (int at, char *s, size_t len);
 
@@ -67,12 +172,27 @@ void editor_append_row (char *s, size_t len);
 
 void editor_row_insert_char (e_row *row, int at, int c);
 
+void editor_row_insert_string (e_row *row, int at, const char *str,
+                               size_t length);
+
 void editor_row_delete_char (e_row *row, int at);
 
+void editor_row_delete_string (e_row *row, int at, size_t length);
+
 void editor_row_append_string (e_row *row, char *str, size_t length);
 
+void editor_free_row (e_row *row);
+
 void editor_delete_row (int at);
 
+// Edits made from editor_begin_edit () to editor_commit_edit () form one
+// transaction: rows only take note that they changed, and what is derived
+// from their text is brought up to date once for each of them at commit.
+// Transactions nest, only the outermost commit does the work, and a
+// transaction is undone in one step.
+void editor_begin_edit ();
+void editor_commit_edit ();
+
 /************************ Editor operations ********************/
 
 void editor_insert_char (char c);
@@ -81,24 +201,58 @@ void editor_delete_char ();
 
 void editor_insert_newline ();
 
+void editor_insert_text (const char *text, int len);
+
+// Replace every occurrence of the LEN bytes of PATTERN with the WITH_LEN
+// bytes of WITH, return how many there were.
+int editor_replace_all (const char *pattern, int len, const char *with,
+                        int with_len);
+
+// Indent rows FROM to TO by a tab, or take one level of indentation off
+// them if OUTDENT. Empty rows are left alone.
+void editor_indent_rows (int from, int to, bool outdent);
+
+void editor_undo ();
+
+void editor_redo ();
+
 /************************ file i/o ********************/
 
 void editor_open (const char *file_name);
 
-// LEAK WARNING: the NEW_BUFFER is expected to free by caller
-char *editor_rows_to_string (int *buffer_length);
+void editor_close ();
 
 bool editor_save ();
 
+// Start or stop following what gets appended to the opened file.
+void editor_follow (bool enable);
+
+// Descriptor that becomes readable when the followed file changes, -1 if
+// none is followed. editor_background_step () takes in the changes.
+int editor_follow_fd ();
+
+// Wait for the rest of the file being loaded in the background.
+void editor_load_wait ();
+
+// Descriptor that becomes readable when more of the file is loaded, -1 if
+// none is. editor_background_step () takes in the rows.
+int editor_load_fd ();
+
+// Open an empty buffer after the last one and show it.
+void editor_new_buffer ();
+
+// Show the buffer at INDEX, counted modulo the number of buffers.
+void editor_switch_buffer (int index);
+
 /************************* output ****************************/
 
 void editorScroll ();
 
-void editor_draw_rows (struct abuf *ab);
+void editor_draw_rows ();
 
-void editor_draw_status_bar (struct abuf *ab);
+void editor_draw_status_bar ();
 
-void editor_draw_message_bar (struct abuf *ab);
+void editor_draw_message_bar ();
 
 void editor_refresh_screen ();
 
@@ -106,13 +260,32 @@ void editor_set_status_message (const char *fmt, ...);
 
 void editor_navigate_cursor (int key);
 
+int editor_next_timeout ();
+
+// Do a slice of the work left to do in the background, false once there is
+// none.
+bool editor_background_step ();
+
 /************************ input ***********************/
 
 void editor_navigate_cursor (int key);
 
+void editor_find ();
+
+// Move the cursor to the start of the 0-based line LINE, or to the last
+// line if there are fewer.
+void editor_goto_line (long long line);
+
 void editor_process_keypress ();
 
 /************************ init ***********************/
+// Lay out the editor for a terminal of ROWS x COLS.
+void editor_set_screen_size (int rows, int cols);
+
+// Pick up the current terminal size.
+void editor_handle_resize ();
+
+// Reset the editor state, the screen size has to be set separately.
 void init_editor ();
 
 #endif
\ No newline at end of file
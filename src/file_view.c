@@ -0,0 +1,217 @@
+// feature test macros
+#define _GNU_SOURCE
+
+#include "file_view.h"
+#include "terminal.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/***************** helpers ************************/
+
+// Read up to LEN bytes at OFFSET into BUFFER and return how many there were.
+static ssize_t
+read_at (const struct file_view *view, char *buffer, size_t len, off_t offset)
+{
+  size_t total = 0;
+
+  while (total < len)
+    {
+      ssize_t n = pread (view->fd, buffer + total, len - total,
+                         offset + total);
+      if (n == -1)
+        die ("pread");
+      if (n == 0)
+        break;
+      total += n;
+    }
+
+  return total;
+}
+
+// Record that line LINES * STRIDE starts at OFFSET.
+static void
+add_entry (struct file_view *view, off_t offset)
+{
+  // Halve a full index, the entries left are STRIDE * 2 lines apart.
+  if (view->num_offsets == FILE_VIEW_MAX_ENTRIES)
+    {
+      for (int i = 0; i < FILE_VIEW_MAX_ENTRIES / 2; i++)
+        view->offsets[i] = view->offsets[i * 2];
+      view->num_offsets = FILE_VIEW_MAX_ENTRIES / 2;
+      view->stride *= 2;
+    }
+
+  view->offsets[view->num_offsets++] = offset;
+}
+
+// Look up where line LINE starts into AT, false if there is no such line.
+static bool
+line_offset (struct file_view *view, long long line, off_t *at)
+{
+  while (view->lines < line && file_view_index_step (view))
+    ;
+  if (line > view->lines)
+    return false;
+
+  // Scan forward from the closest entry before LINE.
+  long long k = line / view->stride;
+  if (k >= view->num_offsets)
+    k = view->num_offsets - 1;
+  off_t offset = view->offsets[k];
+  long long current = k * view->stride;
+
+  while (current < line)
+    {
+      ssize_t n = read_at (view, view->chunk, FILE_VIEW_CHUNK, offset);
+      if (n == 0)
+        return false;
+
+      char *end = view->chunk + n;
+      char *p = view->chunk;
+
+      while (current < line && (p = memchr (p, '\n', end - p)))
+        {
+          current++;
+          p++;
+        }
+
+      offset += current == line ? p - view->chunk : n;
+    }
+
+  // The line after a final newline is not a line.
+  *at = offset;
+  return offset < view->size;
+}
+
+/***************** file view ************************/
+
+void
+file_view_open (struct file_view *view, int fd, off_t size)
+{
+  view->fd = fd;
+  view->size = size;
+  view->offsets = malloc (sizeof (off_t) * FILE_VIEW_MAX_ENTRIES);
+  view->window = malloc (FILE_VIEW_WINDOW);
+  view->chunk = malloc (FILE_VIEW_CHUNK);
+  if (view->offsets == NULL || view->window == NULL || view->chunk == NULL)
+    die ("malloc");
+
+  view->offsets[0] = 0;
+  view->num_offsets = 1;
+  view->stride = FILE_VIEW_STRIDE;
+  view->scanned = 0;
+  view->lines = 0;
+  view->line_start = 0;
+  view->text = view->window;
+  view->text_len = 0;
+  view->first = 0;
+  view->eof = false;
+  view->active = true;
+}
+
+bool
+file_view_index_step (struct file_view *view)
+{
+  if (view->scanned == view->size)
+    return false;
+
+  off_t left = view->size - view->scanned;
+  ssize_t n = read_at (view, view->chunk,
+                       left < FILE_VIEW_CHUNK ? left : FILE_VIEW_CHUNK,
+                       view->scanned);
+
+  // The file got shorter since it was opened.
+  if (n == 0)
+    {
+      view->size = view->scanned;
+      return false;
+    }
+
+  char *end = view->chunk + n;
+  for (char *p = view->chunk; (p = memchr (p, '\n', end - p)); p++)
+    {
+      view->lines++;
+      view->line_start = view->scanned + (p - view->chunk) + 1;
+      if (view->lines % view->stride == 0)
+        add_entry (view, view->line_start);
+    }
+
+  view->scanned += n;
+  return view->scanned < view->size;
+}
+
+long long
+file_view_lines (const struct file_view *view)
+{
+  if (view->scanned < view->size)
+    return -1;
+
+  // A last line without a newline counts as well.
+  return view->lines + (view->line_start < view->size ? 1 : 0);
+}
+
+int
+file_view_progress (const struct file_view *view)
+{
+  return view->size ? view->scanned * 100 / view->size : 100;
+}
+
+void
+file_view_grow (struct file_view *view, off_t size)
+{
+  if (size > view->size)
+    view->size = size;
+}
+
+bool
+file_view_load (struct file_view *view, long long line)
+{
+  off_t at;
+  if (!line_offset (view, line, &at))
+    return false;
+
+  // Center the window on LINE.
+  off_t start = at > FILE_VIEW_WINDOW / 2 ? at - FILE_VIEW_WINDOW / 2 : 0;
+  ssize_t len = read_at (view, view->window, FILE_VIEW_WINDOW, start);
+  char *target = view->window + (at - start);
+  char *end = view->window + len;
+
+  // Drop the line cut at the start, the one before LINE ends before it.
+  char *text = view->window;
+  if (start > 0)
+    text = (char *)memchr (text, '\n', target - text) + 1;
+
+  long long before = 0;
+  for (char *p = text; (p = memchr (p, '\n', target - p)); p++)
+    before++;
+
+  // Drop the line cut at the end too, unless it is LINE itself.
+  view->eof = start + len >= view->size;
+  if (!view->eof)
+    {
+      char *last = end;
+      while (last > target && last[-1] != '\n')
+        last--;
+      if (last > target)
+        end = last;
+    }
+
+  view->text = text;
+  view->text_len = end - text;
+  view->first = line - before;
+  return true;
+}
+
+// desctructor
+void
+file_view_free (struct file_view *view)
+{
+  if (view->fd != -1)
+    close (view->fd);
+  free (view->offsets);
+  free (view->window);
+  free (view->chunk);
+  *view = (struct file_view)FILE_VIEW_INIT;
+}
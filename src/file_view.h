@@ -0,0 +1,76 @@
+#ifndef FILE_VIEW_H
+#define FILE_VIEW_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+// Read-only view of a file too large to load. Only a window of the lines
+// around the one looked at is read into memory, and a sparse index holding
+// the offset of every STRIDE-th line is built a chunk at a time so that any
+// line is reached by scanning at most STRIDE lines. The index has a fixed
+// number of entries: once it is full every other entry is dropped and
+// STRIDE doubles, so memory use does not grow with the size of the file.
+
+// Bytes of the file held in memory at once.
+#define FILE_VIEW_WINDOW (4 * 1024 * 1024)
+// Bytes read by a single step of building the index.
+#define FILE_VIEW_CHUNK (1024 * 1024)
+// Index entries kept at most, and lines between them to start with.
+#define FILE_VIEW_MAX_ENTRIES 65536
+#define FILE_VIEW_STRIDE 1024
+
+struct file_view
+{
+  int fd;
+  off_t size;
+  // Line K * STRIDE starts at OFFSETS[K].
+  off_t *offsets;
+  int num_offsets;
+  long long stride;
+  // The index covers the first SCANNED bytes, which hold LINES newlines,
+  // the last of them ending right before LINE_START.
+  off_t scanned;
+  long long lines;
+  off_t line_start;
+  // Whole lines of the window, starting with line FIRST, a line that does
+  // not fit is cut. EOF if they reach the end of the file.
+  char *window;
+  char *text;
+  int text_len;
+  long long first;
+  bool eof;
+  // Scratch buffer for scanning the file.
+  char *chunk;
+  bool active;
+};
+
+// constructor
+#define FILE_VIEW_INIT                                                        \
+  {                                                                           \
+    -1, 0, NULL, 0, 0, 0, 0, 0, NULL, NULL, 0, 0, false, NULL, false          \
+  }
+
+// Start viewing the SIZE bytes file open as FD, which the view then owns.
+void file_view_open (struct file_view *view, int fd, off_t size);
+
+// desctructor
+void file_view_free (struct file_view *view);
+
+// Extend the index by one chunk, false once it covers the whole file.
+bool file_view_index_step (struct file_view *view);
+
+// Number of lines in the file, -1 while the index is still being built.
+long long file_view_lines (const struct file_view *view);
+
+// Percentage of the file indexed so far.
+int file_view_progress (const struct file_view *view);
+
+// Take in that the file grew to SIZE bytes, the index goes on from where
+// it stopped.
+void file_view_grow (struct file_view *view, off_t size);
+
+// Read the window around line LINE, indexing up to it first if needed.
+// False if the file has no such line.
+bool file_view_load (struct file_view *view, long long line);
+
+#endif
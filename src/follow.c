@@ -0,0 +1,185 @@
+// feature test macros
+#define _GNU_SOURCE
+
+#include "follow.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+/***************** helpers ************************/
+
+// Drain the pending notifications, true if there were any. Which ones they
+// were does not matter, see follow_poll ().
+static bool
+drain_events (int inotify)
+{
+  char buffer[4096];
+  bool any = false;
+
+  while (read (inotify, buffer, sizeof (buffer)) > 0)
+    any = true;
+
+  return any;
+}
+
+// Check that the opened file can be followed from OFFSET on.
+static bool
+check_file (struct follow *follow, off_t offset)
+{
+  struct stat st;
+  if (fstat (follow->fd, &st) == -1)
+    return false;
+
+  if (!S_ISREG (st.st_mode))
+    {
+      errno = EINVAL;
+      return false;
+    }
+
+  // The last line loaded may still be written to.
+  char last = '\n';
+  if (offset > 0 && pread (follow->fd, &last, 1, offset - 1) != 1)
+    return false;
+
+  follow->partial = last != '\n';
+  follow->offset = offset;
+  follow->size = st.st_size;
+  return true;
+}
+
+// Watch the file and its directory where inotify is there, elsewhere the
+// file is looked at every FOLLOW_POLL_MS instead.
+static bool
+add_watches (struct follow *follow)
+{
+#ifdef __linux__
+  follow->inotify = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC);
+  if (follow->inotify == -1)
+    return false;
+
+  follow->file_watch = inotify_add_watch (
+      follow->inotify, follow->path,
+      IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF);
+
+  // A new file taking the name shows up in the directory.
+  char *dir = follow->name == follow->path
+                  ? strdup (".")
+                  : strndup (follow->path, follow->name - follow->path);
+  follow->dir_watch
+      = inotify_add_watch (follow->inotify, dir, IN_CREATE | IN_MOVED_TO);
+  free (dir);
+
+  return follow->file_watch != -1 && follow->dir_watch != -1;
+#else
+  (void)follow;
+  return true;
+#endif
+}
+
+/***************** follow ************************/
+
+bool
+follow_start (struct follow *follow, const char *file_name, off_t offset)
+{
+  follow->path = strdup (file_name);
+  const char *slash = strrchr (follow->path, '/');
+  follow->name = slash ? slash + 1 : follow->path;
+
+  follow->fd = open (file_name, O_RDONLY | O_CLOEXEC);
+  if (follow->fd != -1 && check_file (follow, offset)
+      && add_watches (follow))
+    {
+      follow->active = true;
+      return true;
+    }
+
+  int saved_errno = errno;
+  follow_stop (follow);
+  errno = saved_errno;
+  return false;
+}
+
+int
+follow_fd (const struct follow *follow)
+{
+  return follow->inotify;
+}
+
+int
+follow_timeout (const struct follow *follow)
+{
+  return follow->active && follow->inotify == -1 ? FOLLOW_POLL_MS : -1;
+}
+
+enum follow_change
+follow_poll (struct follow *follow)
+{
+  if (!follow->active
+      || (follow->inotify != -1 && !drain_events (follow->inotify)))
+    return FOLLOW_NONE;
+
+  // Whatever was notified, the file tells what changed. While a rotated
+  // file has no successor yet there is nothing to do.
+  struct stat by_name, by_fd;
+  if (stat (follow->path, &by_name) == -1 || fstat (follow->fd, &by_fd) == -1)
+    return FOLLOW_NONE;
+
+  follow->size = by_fd.st_size;
+  if (by_name.st_ino != by_fd.st_ino || by_name.st_dev != by_fd.st_dev
+      || by_fd.st_size < follow->offset)
+    return FOLLOW_REPLACED;
+
+  if (by_fd.st_size > follow->offset)
+    return FOLLOW_GROWN;
+
+  return FOLLOW_NONE;
+}
+
+ssize_t
+follow_read (struct follow *follow, char *buffer, size_t len)
+{
+  ssize_t n;
+  do
+    n = pread (follow->fd, buffer, len, follow->offset);
+  while (n == -1 && errno == EINTR);
+
+  if (n > 0)
+    {
+      follow->offset += n;
+      follow->partial = buffer[n - 1] != '\n';
+    }
+
+  return n;
+}
+
+void
+follow_skip (struct follow *follow)
+{
+  char last;
+  if (follow->size > follow->offset
+      && pread (follow->fd, &last, 1, follow->size - 1) == 1)
+    {
+      follow->partial = last != '\n';
+      follow->offset = follow->size;
+    }
+}
+
+// desctructor
+void
+follow_stop (struct follow *follow)
+{
+  if (follow->inotify != -1)
+    close (follow->inotify);
+  if (follow->fd != -1)
+    close (follow->fd);
+  free (follow->path);
+  *follow = (struct follow)FOLLOW_INIT;
+}
@@ -0,0 +1,77 @@
+#ifndef FOLLOW_H
+#define FOLLOW_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+// Following a file as it grows, like tail -f. The file and the directory
+// holding it are watched with inotify, so the editor only wakes up when
+// either changes, and only the bytes past the last offset read are read
+// again. A file that got shorter, or that was replaced by another one of
+// the same name as when logs are rotated, has to be opened anew. Systems
+// without inotify look at the file every FOLLOW_POLL_MS instead.
+
+// Bytes of appended data read at once.
+#define FOLLOW_CHUNK (64 * 1024)
+// Milliseconds between looks at the file without inotify.
+#define FOLLOW_POLL_MS 500
+
+enum follow_change
+{
+  FOLLOW_NONE,
+  // Data was appended past OFFSET.
+  FOLLOW_GROWN,
+  // The file was truncated or replaced.
+  FOLLOW_REPLACED,
+};
+
+struct follow
+{
+  // Watches on the file and on its directory, for files created there.
+  // INOTIFY is -1 where there is no inotify.
+  int inotify;
+  int file_watch;
+  int dir_watch;
+  const char *name;
+  char *path;
+  // The file as opened, how much of it has been read and how large it was
+  // last seen.
+  int fd;
+  off_t offset;
+  off_t size;
+  // The last line read has no newline yet.
+  bool partial;
+  bool active;
+};
+
+// constructor
+#define FOLLOW_INIT                                                           \
+  {                                                                           \
+    -1, -1, -1, NULL, NULL, -1, 0, 0, false, false                            \
+  }
+
+// Follow FILE_NAME from OFFSET on, false with errno set if it can't be.
+bool follow_start (struct follow *follow, const char *file_name,
+                   off_t offset);
+
+// desctructor
+void follow_stop (struct follow *follow);
+
+// Descriptor that becomes readable when the file may have changed, -1 if
+// there is none.
+int follow_fd (const struct follow *follow);
+
+// Milliseconds until follow_poll () should look at the file again if there
+// is no descriptor to wait for, -1 if it needn't.
+int follow_timeout (const struct follow *follow);
+
+// Take in the changes notified so far and tell what became of the file.
+enum follow_change follow_poll (struct follow *follow);
+
+// Read up to LEN appended bytes into BUFFER, 0 once all have been read.
+ssize_t follow_read (struct follow *follow, char *buffer, size_t len);
+
+// Take the bytes appended as read without reading them.
+void follow_skip (struct follow *follow);
+
+#endif
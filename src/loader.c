@@ -0,0 +1,264 @@
+// feature test macros
+#define _GNU_SOURCE
+
+#include "loader.h"
+#include "terminal.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
+/***************** helpers ************************/
+
+// Parts done are notified on an eventfd, or on a self-pipe where there is
+// none.
+static void
+events_open (struct loader *loader)
+{
+#ifdef __linux__
+  loader->event_fd = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (loader->event_fd == -1)
+    die ("eventfd");
+  loader->notify_fd = loader->event_fd;
+#else
+  int fds[2];
+  if (pipe (fds) == -1)
+    die ("pipe");
+  for (int i = 0; i < 2; i++)
+    {
+      fcntl (fds[i], F_SETFL, O_NONBLOCK);
+      fcntl (fds[i], F_SETFD, FD_CLOEXEC);
+    }
+  loader->event_fd = fds[0];
+  loader->notify_fd = fds[1];
+#endif
+}
+
+static void
+events_notify (struct loader *loader)
+{
+#ifdef __linux__
+  eventfd_write (loader->notify_fd, 1);
+#else
+  // A full pipe is readable already.
+  write (loader->notify_fd, "", 1);
+#endif
+}
+
+static void
+events_drain (struct loader *loader)
+{
+#ifdef __linux__
+  eventfd_t count;
+  eventfd_read (loader->event_fd, &count);
+#else
+  char drain[64];
+  while (read (loader->event_fd, drain, sizeof (drain)) > 0)
+    ;
+#endif
+}
+
+// Split PART into rows that point into the text, as editor_open () does.
+static void
+load_part (struct loader_part *part)
+{
+  const char *line = part->start;
+
+  while (line < part->end)
+    {
+      const char *newline = memchr (line, '\n', part->end - line);
+      const char *next = newline ? newline + 1 : part->end;
+
+      size_t linelen = next - line;
+      while (linelen > 0
+             && (line[linelen - 1] == '\n' || line[linelen - 1] == '\r'))
+        linelen--;
+
+      e_row *row = row_tree_build (&part->rows);
+      row->size = linelen;
+      row->text = (char *)line;
+      row->mapped = true;
+      line = next;
+    }
+
+  row_tree_build_end (&part->rows);
+}
+
+static void *
+worker (void *arg)
+{
+  struct loader *loader = arg;
+
+  pthread_mutex_lock (&loader->lock);
+  while (!loader->cancel && loader->next < loader->num_parts)
+    {
+      struct loader_part *part = &loader->parts[loader->next++];
+      pthread_mutex_unlock (&loader->lock);
+
+      load_part (part);
+
+      pthread_mutex_lock (&loader->lock);
+      part->done = true;
+      pthread_cond_broadcast (&loader->part_done);
+      events_notify (loader);
+    }
+  pthread_mutex_unlock (&loader->lock);
+
+  return NULL;
+}
+
+// Cut TEXT into parts that end with a whole line.
+static void
+make_parts (struct loader *loader)
+{
+  int max_parts = 2 + loader->size / LOADER_PART;
+  loader->parts = calloc (max_parts, sizeof (struct loader_part));
+  if (loader->parts == NULL)
+    die ("calloc");
+
+  const char *at = loader->text;
+  const char *end = loader->text + loader->size;
+  size_t length = LOADER_FIRST_PART;
+
+  while (at < end)
+    {
+      const char *stop = (size_t)(end - at) > length ? at + length : end;
+      const char *newline = memchr (stop - 1, '\n', end - stop + 1);
+      stop = newline ? newline + 1 : end;
+
+      struct loader_part *part = &loader->parts[loader->num_parts];
+      part->start = at;
+      part->end = stop;
+      part->arena = (struct row_arena)ROW_ARENA_INIT;
+      part->rows
+          = (struct row_tree_builder)ROW_TREE_BUILDER_INIT (&part->arena);
+
+      loader->num_parts++;
+      at = stop;
+      length = LOADER_PART;
+    }
+}
+
+/***************** loader ************************/
+
+void
+loader_start (struct loader *loader, const char *text, size_t size)
+{
+  loader->text = text;
+  loader->size = size;
+  loader->next = 0;
+  loader->merged = 0;
+  loader->cancel = false;
+  make_parts (loader);
+
+  events_open (loader);
+  pthread_mutex_init (&loader->lock, NULL);
+  pthread_cond_init (&loader->part_done, NULL);
+
+  // No more workers than there are processors or parts to go around.
+  long processors = sysconf (_SC_NPROCESSORS_ONLN);
+  int threads = processors > 0 ? processors : 1;
+  if (threads > LOADER_MAX_THREADS)
+    threads = LOADER_MAX_THREADS;
+  if (threads > loader->num_parts)
+    threads = loader->num_parts;
+
+  for (loader->num_threads = 0; loader->num_threads < threads;
+       loader->num_threads++)
+    if (pthread_create (&loader->threads[loader->num_threads], NULL, worker,
+                        loader)
+        != 0)
+      {
+        if (loader->num_threads == 0)
+          die ("pthread_create");
+        break;
+      }
+
+  loader->active = true;
+}
+
+int
+loader_merge (struct loader *loader, struct row_tree *tree,
+              struct row_arena *arena, bool wait)
+{
+  if (!loader->active)
+    return 0;
+
+  // Notifications are taken before looking, a part done right after that
+  // notifies again.
+  events_drain (loader);
+
+  pthread_mutex_lock (&loader->lock);
+  if (wait)
+    while (!loader->parts[loader->merged].done)
+      pthread_cond_wait (&loader->part_done, &loader->lock);
+
+  int done = loader->merged;
+  while (done < loader->num_parts && loader->parts[done].done)
+    done++;
+  pthread_mutex_unlock (&loader->lock);
+
+  // Parts done are no longer touched by the workers.
+  int rows = 0;
+  for (; loader->merged < done; loader->merged++)
+    {
+      struct loader_part *part = &loader->parts[loader->merged];
+      rows += part->rows.count;
+      row_tree_append_built (tree, &part->rows);
+      row_arena_adopt (arena, &part->arena);
+    }
+
+  if (loader->merged == loader->num_parts)
+    loader_free (loader);
+
+  return rows;
+}
+
+int
+loader_fd (const struct loader *loader)
+{
+  return loader->event_fd;
+}
+
+int
+loader_progress (const struct loader *loader)
+{
+  if (!loader->active)
+    return 100;
+  if (loader->merged == 0)
+    return 0;
+
+  const char *end = loader->parts[loader->merged - 1].end;
+  return (long long)(end - loader->text) * 100 / loader->size;
+}
+
+// desctructor
+void
+loader_free (struct loader *loader)
+{
+  if (!loader->active)
+    return;
+
+  pthread_mutex_lock (&loader->lock);
+  loader->cancel = true;
+  pthread_mutex_unlock (&loader->lock);
+
+  for (int i = 0; i < loader->num_threads; i++)
+    pthread_join (loader->threads[i], NULL);
+
+  for (int i = 0; i < loader->num_parts; i++)
+    row_arena_release (&loader->parts[i].arena);
+  free (loader->parts);
+
+  close (loader->event_fd);
+  if (loader->notify_fd != loader->event_fd)
+    close (loader->notify_fd);
+  pthread_mutex_destroy (&loader->lock);
+  pthread_cond_destroy (&loader->part_done);
+  *loader = (struct loader)LOADER_INIT;
+}
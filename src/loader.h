@@ -0,0 +1,82 @@
+#ifndef LOADER_H
+#define LOADER_H
+
+#include "row_arena.h"
+#include "row_tree.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Loading a mapped file in parts that worker threads split into rows at
+// the same time. Parts end with a whole line, and each is built into a row
+// tree of its own, in an arena of its own, so the workers share nothing but
+// the queue of parts. The parts done are then appended to the document in
+// order, the first one as soon as it is ready so that a screen of the file
+// is shown before the rest is loaded.
+
+// Bytes of the first part, which is enough for a screen, and of the others.
+#define LOADER_FIRST_PART (64 * 1024)
+#define LOADER_PART (4 * 1024 * 1024)
+// Worker threads started at most.
+#define LOADER_MAX_THREADS 8
+
+struct loader_part
+{
+  const char *start;
+  const char *end;
+  struct row_arena arena;
+  struct row_tree_builder rows;
+  bool done;
+};
+
+struct loader
+{
+  const char *text;
+  size_t size;
+  struct loader_part *parts;
+  int num_parts;
+  // Next part for a worker to take and next one to be appended, both
+  // guarded by LOCK along with the DONE flags of the parts.
+  int next;
+  int merged;
+  pthread_mutex_t lock;
+  pthread_cond_t part_done;
+  pthread_t threads[LOADER_MAX_THREADS];
+  int num_threads;
+  // Readable while there are parts done but not appended, the workers
+  // notify on NOTIFY_FD, which is the same descriptor unless it is a pipe.
+  int event_fd;
+  int notify_fd;
+  bool cancel;
+  bool active;
+};
+
+// constructor
+#define LOADER_INIT                                                           \
+  {                                                                           \
+    NULL, 0, NULL, 0, 0, 0, PTHREAD_MUTEX_INITIALIZER,                        \
+        PTHREAD_COND_INITIALIZER, { 0 }, 0, -1, -1, false, false              \
+  }
+
+// Start loading the SIZE bytes of TEXT, whose rows will point into it.
+void loader_start (struct loader *loader, const char *text, size_t size);
+
+// desctructor, the workers are stopped and the parts not appended dropped.
+void loader_free (struct loader *loader);
+
+// Append the rows of the parts done so far to TREE in order, their nodes
+// going to ARENA, and return how many there were. With WAIT, the next part
+// is waited for if it is not done yet. The loader is no longer active once
+// every part has been appended.
+int loader_merge (struct loader *loader, struct row_tree *tree,
+                  struct row_arena *arena, bool wait);
+
+// Descriptor that becomes readable when parts are done, -1 if none is
+// being loaded.
+int loader_fd (const struct loader *loader);
+
+// Percentage of the file appended so far.
+int loader_progress (const struct loader *loader);
+
+#endif
@@ -5,20 +5,123 @@
 
 #include "editor.h"
 #include "terminal.h"
+#include "trace.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <locale.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+
+// Self-pipe that turns SIGWINCH into an event for poll ().
+static int resize_pipe[2];
+
+static void
+handle_sigwinch (int sig)
+{
+  (void)sig;
+  int saved_errno = errno;
+  write (resize_pipe[1], "", 1);
+  errno = saved_errno;
+}
+
+static void
+watch_resize ()
+{
+  if (pipe (resize_pipe) == -1)
+    die ("pipe");
+
+  for (int i = 0; i < 2; i++)
+    {
+      fcntl (resize_pipe[i], F_SETFL, O_NONBLOCK);
+      fcntl (resize_pipe[i], F_SETFD, FD_CLOEXEC);
+    }
+
+  struct sigaction sa;
+  sa.sa_handler = handle_sigwinch;
+  sigemptyset (&sa.sa_mask);
+  sa.sa_flags = SA_RESTART;
+  if (sigaction (SIGWINCH, &sa, NULL) == -1)
+    die ("sigaction");
+}
 
 int
 main (int argc, char *argv[])
 {
+  // Character widths come from the locale.
+  setlocale (LC_CTYPE, "");
   enable_raw_mode ();
   init_editor ();
-  if (argc >= 2)
-    editor_open (argv[1]);
+  editor_handle_resize ();
+  watch_resize ();
+
+  // "--trace FILE" writes where the time goes to FILE as trace events.
+  int first = 1;
+  if (argc >= 3 && strcmp (argv[1], "--trace") == 0)
+    {
+      if (!trace_open (argv[2]))
+        die ("trace_open");
+      first = 3;
+    }
 
-  editor_set_status_message ("HELP: Ctrl-S = save | Ctrl-Q = quit");
+  // "-f FILE" follows what gets appended to FILE, as tail -f does. Every
+  // file given is opened in a buffer of its own.
+  bool follow = argc >= first + 2 && strcmp (argv[first], "-f") == 0;
+  if (follow)
+    first++;
+  for (int i = first; i < argc; i++)
+    {
+      if (i > first)
+        editor_new_buffer ();
+      editor_open (argv[i]);
+    }
+
+  editor_set_status_message (
+      "HELP: Ctrl-S = save | Ctrl-Q = quit | Ctrl-F = find | Ctrl-Z = undo");
+  editor_switch_buffer (0);
+  if (follow)
+    editor_follow (true);
 
   while (1)
     {
-      editor_refresh_screen ();
+      // Keys that arrived together are handled before a single redraw.
+      if (!editor_input_pending ())
+        {
+          editor_refresh_screen ();
+
+          // Sleep until there is input, a resize, more of the file loaded,
+          // a change to the followed file or a timed redraw.
+          struct pollfd fds[4] = { { STDIN_FILENO, POLLIN, 0 },
+                                   { resize_pipe[0], POLLIN, 0 },
+                                   { editor_load_fd (), POLLIN, 0 },
+                                   { editor_follow_fd (), POLLIN, 0 } };
+          trace_syscall ();
+          if (poll (fds, 4, editor_next_timeout ()) == -1)
+            {
+              if (errno == EINTR)
+                continue;
+              die ("poll");
+            }
+
+          if (fds[1].revents & POLLIN)
+            {
+              char drain[64];
+              while (read (resize_pipe[0], drain, sizeof (drain)) > 0)
+                ;
+              editor_handle_resize ();
+            }
+
+          // No input, the time goes to work left in the background.
+          if (!(fds[0].revents & (POLLIN | POLLHUP | POLLERR)))
+            {
+              editor_background_step ();
+              continue;
+            }
+        }
+
       editor_process_keypress ();
     }
 
@@ -0,0 +1,208 @@
+#include "render_cache.h"
+#include "terminal.h"
+
+#include <stdlib.h>
+
+struct render_slot
+{
+  e_row *owner;
+  char *buffer;
+  int capacity;
+  // Where the owner rendered into BUFFER, NULL for what it takes none of.
+  struct column_checkpoint *columns;
+  unsigned char *highlight;
+  // Neighbours in recency order, -1 at either end of the list.
+  int prev;
+  int next;
+};
+
+static struct render_slot *slots = NULL;
+static int num_slots = 0;
+static int alloc_slots = 0;
+static int max_slots = RENDER_CACHE_MIN_ROWS;
+
+// Most recently used slot, unused slots are always kept at the tail.
+static int head = -1;
+static int tail = -1;
+
+/***************** helpers ************************/
+
+static void
+slot_unlink (int i)
+{
+  struct render_slot *slot = &slots[i];
+
+  if (slot->prev != -1)
+    slots[slot->prev].next = slot->next;
+  else
+    head = slot->next;
+
+  if (slot->next != -1)
+    slots[slot->next].prev = slot->prev;
+  else
+    tail = slot->prev;
+}
+
+static void
+slot_push_head (int i)
+{
+  slots[i].prev = -1;
+  slots[i].next = head;
+  if (head != -1)
+    slots[head].prev = i;
+  head = i;
+  if (tail == -1)
+    tail = i;
+}
+
+static void
+slot_push_tail (int i)
+{
+  slots[i].next = -1;
+  slots[i].prev = tail;
+  if (tail != -1)
+    slots[tail].next = i;
+  tail = i;
+  if (head == -1)
+    head = i;
+}
+
+static int
+slot_new ()
+{
+  if (num_slots == alloc_slots)
+    {
+      int count = alloc_slots ? alloc_slots * 2 : RENDER_CACHE_MIN_ROWS;
+      struct render_slot *new
+          = realloc (slots, sizeof (struct render_slot) * count);
+      if (new == NULL)
+        die ("realloc");
+
+      slots = new;
+      alloc_slots = count;
+    }
+
+  slots[num_slots].owner = NULL;
+  slots[num_slots].buffer = NULL;
+  slots[num_slots].capacity = 0;
+  slots[num_slots].columns = NULL;
+  slots[num_slots].highlight = NULL;
+  return num_slots++;
+}
+
+// Let go of the buffer of slot I once its row is gone if it grew past
+// RENDER_CACHE_KEEP, e.g. for a very long line, rather than hold on to it
+// for good.
+static void
+slot_trim (int i)
+{
+  if (slots[i].capacity <= RENDER_CACHE_KEEP)
+    return;
+
+  free (slots[i].buffer);
+  slots[i].buffer = NULL;
+  slots[i].capacity = 0;
+}
+
+/***************** render cache ************************/
+
+void
+render_cache_reserve (int rows)
+{
+  if (rows > RENDER_CACHE_MAX_ROWS)
+    rows = RENDER_CACHE_MAX_ROWS;
+  if (rows > max_slots)
+    max_slots = rows;
+}
+
+void
+render_cache_alloc (e_row *row, int checkpoints, int highlight)
+{
+  int index_size = sizeof (struct column_checkpoint) * checkpoints;
+  int len = index_size + highlight;
+  int i;
+
+  if (row->cache_slot)
+    {
+      i = row->cache_slot - 1;
+      slot_unlink (i);
+    }
+  else if (num_slots < max_slots && (tail == -1 || slots[tail].owner))
+    i = slot_new ();
+  else
+    {
+      i = tail;
+      slot_unlink (i);
+
+      if (slots[i].owner)
+        slots[i].owner->cache_slot = 0;
+      slot_trim (i);
+    }
+
+  struct render_slot *slot = &slots[i];
+  if (slot->capacity < len)
+    {
+      char *buffer = realloc (slot->buffer, len);
+      if (buffer == NULL)
+        die ("realloc");
+      slot->buffer = buffer;
+      slot->capacity = len;
+    }
+
+  slot->owner = row;
+  slot->columns
+      = checkpoints ? (struct column_checkpoint *)slot->buffer : NULL;
+  slot->highlight
+      = highlight ? (unsigned char *)&slot->buffer[index_size] : NULL;
+  row->cache_slot = i + 1;
+  slot_push_head (i);
+}
+
+struct column_checkpoint *
+render_cache_columns (const e_row *row)
+{
+  return row->cache_slot ? slots[row->cache_slot - 1].columns : NULL;
+}
+
+unsigned char *
+render_cache_highlight (const e_row *row)
+{
+  return row->cache_slot ? slots[row->cache_slot - 1].highlight : NULL;
+}
+
+void
+render_cache_touch (e_row *row)
+{
+  if (row->cache_slot == 0)
+    return;
+
+  slot_unlink (row->cache_slot - 1);
+  slot_push_head (row->cache_slot - 1);
+}
+
+void
+render_cache_drop (e_row *row)
+{
+  if (row->cache_slot == 0)
+    return;
+
+  int i = row->cache_slot - 1;
+  slot_unlink (i);
+  slots[i].owner = NULL;
+  slot_push_tail (i);
+  row->cache_slot = 0;
+}
+
+void
+render_cache_clear ()
+{
+  for (int i = 0; i < num_slots; i++)
+    {
+      if (slots[i].owner)
+        {
+          slots[i].owner->cache_slot = 0;
+          slots[i].owner = NULL;
+        }
+      slot_trim (i);
+    }
+}
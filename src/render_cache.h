@@ -0,0 +1,40 @@
+#ifndef RENDER_CACHE_H
+#define RENDER_CACHE_H
+
+#include "row_tree.h"
+
+// What drawing a row takes is only built for the rows that get drawn, into
+// a bounded pool of buffers recycled in least recently used order. Rows
+// only keep the number of their slot, evicting a row simply resets it so
+// that what the row takes is rebuilt on next draw.
+
+// Minimum number of rendered rows kept around, and maximum, as slots are
+// numbered by the CACHE_SLOT of the rows.
+#define RENDER_CACHE_MIN_ROWS 256
+#define RENDER_CACHE_MAX_ROWS 65535
+// Bytes a slot keeps once its row is evicted, bigger buffers are freed.
+#define RENDER_CACHE_KEEP (64 * 1024)
+
+// Make sure that at least ROWS rendered rows fit in the cache.
+void render_cache_reserve (int rows);
+
+// Make room for what drawing ROW takes, CHECKPOINTS column checkpoints and
+// HIGHLIGHT bytes of highlight classes, evicting the least recently used
+// row if the cache is full.
+void render_cache_alloc (e_row *row, int checkpoints, int highlight);
+
+// Column checkpoints and highlight classes of ROW, NULL if it takes none
+// or is not rendered.
+struct column_checkpoint *render_cache_columns (const e_row *row);
+unsigned char *render_cache_highlight (const e_row *row);
+
+// Mark the rendered buffer of ROW as most recently used.
+void render_cache_touch (e_row *row);
+
+// Give the buffer of ROW back to the cache.
+void render_cache_drop (e_row *row);
+
+// Give back every buffer, e.g. before the rows owning them are released.
+void render_cache_clear ();
+
+#endif
@@ -0,0 +1,243 @@
+#include "row_arena.h"
+#include "terminal.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+struct row_arena_chunk
+{
+  struct row_arena_chunk *next;
+};
+
+// Header of blocks too big for a size class, kept in a list so that they
+// can be released along with the chunks.
+struct row_arena_large
+{
+  struct row_arena_large *prev;
+  struct row_arena_large *next;
+};
+
+/***************** size classes ************************/
+
+// Classes are multiples of 8 bytes up to 128 and then four steps per power
+// of two up to ROW_ARENA_MAX_BLOCK, i.e. 8, 16, ..., 128, 160, 192, ...
+static int
+size_class (int size)
+{
+  if (size <= 8)
+    return 0;
+  if (size <= 128)
+    return (size + 7) / 8 - 1;
+
+  int shift = 31 - __builtin_clz (size - 1);
+  int step = 1 << (shift - 2);
+  int k = (size - (1 << shift) + step - 1) / step;
+  return 16 + (shift - 7) * 4 + (k - 1);
+}
+
+static int
+class_size (int index)
+{
+  if (index < 16)
+    return (index + 1) * 8;
+
+  int shift = (index - 16) / 4 + 7;
+  int k = (index - 16) % 4 + 1;
+  return (1 << shift) + k * (1 << (shift - 2));
+}
+
+/***************** helpers ************************/
+
+static void *
+large_alloc (struct row_arena *arena, int size)
+{
+  struct row_arena_large *block
+      = malloc (sizeof (struct row_arena_large) + size);
+  if (block == NULL)
+    die ("malloc");
+
+  block->prev = NULL;
+  block->next = arena->large;
+  if (arena->large)
+    arena->large->prev = block;
+  arena->large = block;
+  arena->reserved += size;
+
+  return block + 1;
+}
+
+static void
+large_free (struct row_arena *arena, void *p, int capacity)
+{
+  struct row_arena_large *block = (struct row_arena_large *)p - 1;
+
+  if (block->prev)
+    block->prev->next = block->next;
+  else
+    arena->large = block->next;
+  if (block->next)
+    block->next->prev = block->prev;
+
+  arena->reserved -= capacity;
+  free (block);
+}
+
+// Carve a block of SIZE bytes out of the current chunk.
+static void *
+bump_alloc (struct row_arena *arena, int size)
+{
+  if (arena->bump_end - arena->bump < size)
+    {
+      struct row_arena_chunk *chunk = malloc (ROW_ARENA_CHUNK);
+      if (chunk == NULL)
+        die ("malloc");
+
+      chunk->next = arena->chunks;
+      arena->chunks = chunk;
+      arena->reserved += ROW_ARENA_CHUNK;
+
+      // Keep blocks 8 byte aligned past the chunk header.
+      arena->bump = (char *)chunk + 8 * ((sizeof (*chunk) + 7) / 8);
+      arena->bump_end = (char *)chunk + ROW_ARENA_CHUNK;
+    }
+
+  void *p = arena->bump;
+  arena->bump += size;
+  return p;
+}
+
+/***************** row arena ************************/
+
+void *
+row_arena_alloc (struct row_arena *arena, int size, int *capacity)
+{
+  if (size > ROW_ARENA_MAX_BLOCK)
+    {
+      *capacity = size;
+      return large_alloc (arena, size);
+    }
+
+  int index = size_class (size);
+  *capacity = class_size (index);
+
+  void *p = arena->free_lists[index];
+  if (p)
+    {
+      arena->free_lists[index] = *(void **)p;
+      return p;
+    }
+
+  return bump_alloc (arena, *capacity);
+}
+
+void *
+row_arena_realloc (struct row_arena *arena, void *p, int old_capacity,
+                   int size, int *capacity)
+{
+  // Big blocks are resized in place by malloc when possible.
+  if (old_capacity > ROW_ARENA_MAX_BLOCK && size > ROW_ARENA_MAX_BLOCK)
+    {
+      struct row_arena_large *block = (struct row_arena_large *)p - 1;
+      struct row_arena_large *new
+          = realloc (block, sizeof (struct row_arena_large) + size);
+      if (new == NULL)
+        die ("realloc");
+
+      if (new->prev)
+        new->prev->next = new;
+      else
+        arena->large = new;
+      if (new->next)
+        new->next->prev = new;
+
+      arena->reserved += size - old_capacity;
+      *capacity = size;
+      return new + 1;
+    }
+
+  void *new = row_arena_alloc (arena, size, capacity);
+  if (p)
+    {
+      memcpy (new, p, old_capacity < *capacity ? old_capacity : *capacity);
+      row_arena_free (arena, p, old_capacity);
+    }
+  return new;
+}
+
+void
+row_arena_free (struct row_arena *arena, void *p, int capacity)
+{
+  if (p == NULL)
+    return;
+
+  if (capacity > ROW_ARENA_MAX_BLOCK)
+    {
+      large_free (arena, p, capacity);
+      return;
+    }
+
+  int index = size_class (capacity);
+  *(void **)p = arena->free_lists[index];
+  arena->free_lists[index] = p;
+}
+
+void
+row_arena_adopt (struct row_arena *arena, struct row_arena *other)
+{
+  // The chunks of OTHER go behind the newest one of ARENA, which blocks are
+  // still carved out of.
+  if (other->chunks)
+    {
+      struct row_arena_chunk *last = other->chunks;
+      while (last->next)
+        last = last->next;
+
+      if (arena->chunks)
+        {
+          last->next = arena->chunks->next;
+          arena->chunks->next = other->chunks;
+        }
+      else
+        {
+          arena->chunks = other->chunks;
+          arena->bump = other->bump;
+          arena->bump_end = other->bump_end;
+        }
+    }
+
+  if (other->large)
+    {
+      struct row_arena_large *last = other->large;
+      while (last->next)
+        last = last->next;
+
+      last->next = arena->large;
+      if (arena->large)
+        arena->large->prev = last;
+      arena->large = other->large;
+    }
+
+  arena->reserved += other->reserved;
+  *other = (struct row_arena)ROW_ARENA_INIT;
+}
+
+// desctructor
+void
+row_arena_release (struct row_arena *arena)
+{
+  while (arena->chunks)
+    {
+      struct row_arena_chunk *next = arena->chunks->next;
+      free (arena->chunks);
+      arena->chunks = next;
+    }
+
+  while (arena->large)
+    {
+      struct row_arena_large *next = arena->large->next;
+      free (arena->large);
+      arena->large = next;
+    }
+
+  *arena = (struct row_arena)ROW_ARENA_INIT;
+}
@@ -0,0 +1,53 @@
+#ifndef ROW_ARENA_H
+#define ROW_ARENA_H
+
+#include <stddef.h>
+
+// Allocator for everything a document owns per row: tree nodes and text.
+// Blocks up to ROW_ARENA_MAX_BLOCK bytes are carved out of large chunks in
+// size classes about 25% apart and recycled through per-class free lists,
+// bigger ones go to malloc. Releasing the arena frees all of them at once.
+
+#define ROW_ARENA_CHUNK (64 * 1024)
+#define ROW_ARENA_MAX_BLOCK 4096
+#define ROW_ARENA_CLASSES 36
+
+struct row_arena_chunk;
+struct row_arena_large;
+
+struct row_arena
+{
+  struct row_arena_chunk *chunks;
+  struct row_arena_large *large;
+  // Unused part of the newest chunk.
+  char *bump;
+  char *bump_end;
+  void *free_lists[ROW_ARENA_CLASSES];
+  // Bytes obtained from malloc, for statistics.
+  size_t reserved;
+};
+
+// constructor
+#define ROW_ARENA_INIT                                                        \
+  {                                                                           \
+    NULL, NULL, NULL, NULL, { NULL }, 0                                       \
+  }
+
+// Allocate at least SIZE bytes, the usable size is stored in CAPACITY.
+void *row_arena_alloc (struct row_arena *arena, int size, int *capacity);
+
+// Move the OLD_CAPACITY bytes block P to one of at least SIZE bytes.
+void *row_arena_realloc (struct row_arena *arena, void *p, int old_capacity,
+                         int size, int *capacity);
+
+// Give back the block P of CAPACITY bytes.
+void row_arena_free (struct row_arena *arena, void *p, int capacity);
+
+// Take over every block of OTHER, e.g. one filled by another thread, and
+// leave it empty. The blocks are then released along with ARENA.
+void row_arena_adopt (struct row_arena *arena, struct row_arena *other);
+
+// desctructor, frees every block of the arena at once.
+void row_arena_release (struct row_arena *arena);
+
+#endif
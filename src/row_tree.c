@@ -0,0 +1,422 @@
+#include "row_tree.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/***************** helpers ************************/
+
+static struct row_node *
+node_of (const e_row *row)
+{
+  return (struct row_node *)((char *)row - offsetof (struct row_node, row));
+}
+
+// Priority of NODE in the treap, a hash of its address. Balancing only
+// needs the priorities to look random, and nodes never move.
+static unsigned int
+node_priority (const struct row_node *node)
+{
+  unsigned long long x = (uintptr_t)node;
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdULL;
+  x ^= x >> 33;
+  x *= 0xc4ceb9fe1a85ec53ULL;
+  x ^= x >> 33;
+  return x;
+}
+
+// Bytes of text kept behind a row of inline class CLASS, 0 for none.
+static int
+inline_size (int class)
+{
+  return 8 * class;
+}
+
+static int
+node_count (const struct row_node *node)
+{
+  return node ? node->count : 0;
+}
+
+static long long
+node_bytes (const struct row_node *node)
+{
+  return node ? node->bytes : 0;
+}
+
+static int
+node_lines (const struct row_node *node)
+{
+  return node ? node->lines : 0;
+}
+
+// Recompute the sums NODE caches of the row sizes and lines.
+static void
+node_pull_sizes (struct row_node *node)
+{
+  node->bytes = node->row.size + 1 + node_bytes (node->left)
+                + node_bytes (node->right);
+  node->lines
+      = node->row.lines + node_lines (node->left) + node_lines (node->right);
+}
+
+// Recompute cached subtree data of NODE and re-parent its children.
+static void
+node_pull (struct row_node *node)
+{
+  node->count = 1 + node_count (node->left) + node_count (node->right);
+  node_pull_sizes (node);
+
+  if (node->left)
+    node->left->parent = node;
+  if (node->right)
+    node->right->parent = node;
+}
+
+// Split NODE so that its first K rows end up in LEFT and the rest in RIGHT.
+static void
+node_split (struct row_node *node, int k, struct row_node **left,
+            struct row_node **right)
+{
+  if (node == NULL)
+    {
+      *left = NULL;
+      *right = NULL;
+      return;
+    }
+
+  if (node_count (node->left) < k)
+    {
+      node_split (node->right, k - node_count (node->left) - 1, &node->right,
+                  right);
+      *left = node;
+    }
+  else
+    {
+      node_split (node->left, k, left, &node->left);
+      *right = node;
+    }
+  node_pull (node);
+}
+
+// Recompute the cached subtree data below NODE, children first.
+static void
+node_pull_all (struct row_node *node)
+{
+  if (node == NULL)
+    return;
+
+  node_pull_all (node->left);
+  node_pull_all (node->right);
+  node_pull (node);
+}
+
+// Concatenate two trees, every row of A is placed before the rows of B.
+static struct row_node *
+node_merge (struct row_node *a, struct row_node *b)
+{
+  if (a == NULL)
+    return b;
+  if (b == NULL)
+    return a;
+
+  if (node_priority (a) > node_priority (b))
+    {
+      a->right = node_merge (a->right, b);
+      node_pull (a);
+      return a;
+    }
+
+  b->left = node_merge (a, b->left);
+  node_pull (b);
+  return b;
+}
+
+/***************** row tree ************************/
+
+int
+row_tree_size (const struct row_tree *tree)
+{
+  return node_count (tree->root);
+}
+
+e_row *
+row_tree_at (const struct row_tree *tree, int at)
+{
+  struct row_node *node = tree->root;
+
+  if (at < 0 || at >= node_count (node))
+    return NULL;
+
+  while (node)
+    {
+      int left = node_count (node->left);
+      if (at < left)
+        node = node->left;
+      else if (at == left)
+        return &node->row;
+      else
+        {
+          at -= left + 1;
+          node = node->right;
+        }
+    }
+
+  return NULL;
+}
+
+e_row *
+row_tree_insert (struct row_tree *tree, int at, int text_size)
+{
+  // Arena blocks come in steps of 8 bytes this small, so the node and its
+  // text fill one exactly.
+  int class = 0;
+  if (text_size <= ROW_TREE_INLINE)
+    class = (text_size + 7) / 8;
+
+  int capacity;
+  struct row_node *node = row_arena_alloc (
+      tree->arena, sizeof (struct row_node) + inline_size (class), &capacity);
+  memset (node, 0, sizeof (struct row_node));
+
+  node->count = 1;
+  node->bytes = 1;
+  if (class)
+    {
+      node->row.text = (char *)(node + 1);
+      node->row.capacity = inline_size (class);
+      node->row.inline_class = class;
+    }
+
+  struct row_node *left, *right;
+  node_split (tree->root, at, &left, &right);
+  tree->root = node_merge (node_merge (left, node), right);
+  tree->root->parent = NULL;
+
+  return &node->row;
+}
+
+e_row *
+row_tree_build (struct row_tree_builder *builder)
+{
+  int capacity;
+  struct row_node *node = row_arena_alloc (
+      builder->tree.arena, sizeof (struct row_node), &capacity);
+  memset (node, 0, sizeof (struct row_node));
+
+  // The last row is the bottom of the right spine. The new one takes the
+  // place of the lowest node on it with a smaller priority, which becomes
+  // its left child, so appending is amortized O(1).
+  struct row_node *child = NULL;
+  struct row_node *parent = builder->last;
+  while (parent && node_priority (parent) < node_priority (node))
+    {
+      child = parent;
+      parent = parent->parent;
+    }
+
+  node->left = child;
+  if (child)
+    child->parent = node;
+  node->parent = parent;
+  if (parent)
+    parent->right = node;
+  else
+    builder->tree.root = node;
+
+  builder->last = node;
+  builder->count++;
+  return &node->row;
+}
+
+void
+row_tree_build_end (struct row_tree_builder *builder)
+{
+  node_pull_all (builder->tree.root);
+  if (builder->tree.root)
+    builder->tree.root->parent = NULL;
+}
+
+void
+row_tree_append_built (struct row_tree *tree,
+                       struct row_tree_builder *builder)
+{
+  tree->root = node_merge (tree->root, builder->tree.root);
+  if (tree->root)
+    tree->root->parent = NULL;
+
+  builder->tree.root = NULL;
+  builder->last = NULL;
+  builder->count = 0;
+}
+
+void
+row_tree_remove (struct row_tree *tree, e_row *row)
+{
+  struct row_node *node = node_of (row);
+  struct row_node *parent = node->parent;
+
+  // Both subtrees only hold lower priorities than NODE, so their merge can
+  // take its place directly.
+  struct row_node *sub = node_merge (node->left, node->right);
+  if (sub)
+    sub->parent = parent;
+
+  if (parent == NULL)
+    tree->root = sub;
+  else if (parent->left == node)
+    parent->left = sub;
+  else
+    parent->right = sub;
+
+  for (; parent; parent = parent->parent)
+    node_pull (parent);
+
+  row_arena_free (tree->arena, node,
+                  sizeof (struct row_node) + inline_size (row->inline_class));
+}
+
+bool
+row_tree_text_inline (const e_row *row)
+{
+  return row->inline_class && row->text == (char *)(node_of (row) + 1);
+}
+
+int
+row_tree_index_of (const e_row *row)
+{
+  const struct row_node *node = node_of (row);
+  int at = node_count (node->left);
+
+  for (; node->parent; node = node->parent)
+    if (node->parent->right == node)
+      at += node_count (node->parent->left) + 1;
+
+  return at;
+}
+
+void
+row_tree_resized (e_row *row)
+{
+  for (struct row_node *node = node_of (row); node; node = node->parent)
+    node_pull_sizes (node);
+}
+
+void
+row_tree_refresh (struct row_tree *tree)
+{
+  node_pull_all (tree->root);
+}
+
+long long
+row_tree_offset_of (const e_row *row)
+{
+  const struct row_node *node = node_of (row);
+  long long offset = node_bytes (node->left);
+
+  for (; node->parent; node = node->parent)
+    if (node->parent->right == node)
+      offset += node_bytes (node->parent->left) + node->parent->row.size + 1;
+
+  return offset;
+}
+
+long long
+row_tree_bytes (const struct row_tree *tree)
+{
+  return node_bytes (tree->root);
+}
+
+int
+row_tree_line_of (const e_row *row)
+{
+  const struct row_node *node = node_of (row);
+  int line = node_lines (node->left);
+
+  for (; node->parent; node = node->parent)
+    if (node->parent->right == node)
+      line += node_lines (node->parent->left) + node->parent->row.lines;
+
+  return line;
+}
+
+int
+row_tree_lines (const struct row_tree *tree)
+{
+  return node_lines (tree->root);
+}
+
+e_row *
+row_tree_at_line (const struct row_tree *tree, int line, int *first)
+{
+  struct row_node *node = tree->root;
+
+  if (line < 0 || line >= node_lines (node))
+    return NULL;
+
+  *first = 0;
+  while (node)
+    {
+      int left = node_lines (node->left);
+      if (line < left)
+        node = node->left;
+      else if (line < left + node->row.lines)
+        {
+          *first += left;
+          return &node->row;
+        }
+      else
+        {
+          line -= left + node->row.lines;
+          *first += left + node->row.lines;
+          node = node->right;
+        }
+    }
+
+  return NULL;
+}
+
+e_row *
+row_tree_next (const e_row *row)
+{
+  const struct row_node *node = node_of (row);
+
+  if (node->right)
+    {
+      node = node->right;
+      while (node->left)
+        node = node->left;
+      return (e_row *)&node->row;
+    }
+
+  while (node->parent && node->parent->right == node)
+    node = node->parent;
+
+  return node->parent ? (e_row *)&node->parent->row : NULL;
+}
+
+e_row *
+row_tree_prev (const e_row *row)
+{
+  const struct row_node *node = node_of (row);
+
+  if (node->left)
+    {
+      node = node->left;
+      while (node->right)
+        node = node->right;
+      return (e_row *)&node->row;
+    }
+
+  while (node->parent && node->parent->left == node)
+    node = node->parent;
+
+  return node->parent ? (e_row *)&node->parent->row : NULL;
+}
+
+void
+row_tree_clear (struct row_tree *tree)
+{
+  tree->root = NULL;
+}
@@ -0,0 +1,141 @@
+#ifndef ROW_TREE_H
+#define ROW_TREE_H
+
+#include "columns.h"
+#include "row_arena.h"
+
+#include <stdbool.h>
+
+typedef struct editor_row
+{
+  char *text;
+  int size;
+  // Screen lines the row takes when soft wrapped, see editor_wrap_lines ().
+  int lines;
+  // Bytes allocated for TEXT, 0 while it is mapped.
+  int capacity;
+  // 1-based render cache slot holding what drawing the row takes, 0 if
+  // none, see editor_render_row ().
+  unsigned short cache_slot;
+  // Lexer state at the end of the row, see editor_update_syntax ().
+  unsigned char hl_state;
+  // TEXT is a view into the file mapping and must be copied before it is
+  // modified, see editor_row_own ().
+  bool mapped : 1;
+  // Changed by the edit transaction in progress, see editor_begin_edit ().
+  bool dirty : 1;
+  // Room for text behind the row in steps of 8 bytes, see
+  // row_tree_insert ().
+  unsigned char inline_class : 4;
+} e_row;
+
+// Rows of a document are kept in an implicit treap ordered by position.
+// Each node caches the number of rows in its subtree, which gives O(log n)
+// lookup, insertion and deletion by row index while the rows themselves
+// never move in memory. Nodes are allocated from the arena of the document,
+// a short row with its text right behind it, and their priorities are
+// hashed from their address rather than stored.
+// The bytes of the subtree as saved, each row followed by a newline, are
+// cached as well to find where a row starts in the file, and the screen
+// lines of the subtree to map between rows and lines when soft wrapping.
+struct row_node
+{
+  e_row row;
+  struct row_node *left;
+  struct row_node *right;
+  struct row_node *parent;
+  int count;
+  int lines;
+  long long bytes;
+};
+
+struct row_tree
+{
+  struct row_node *root;
+  struct row_arena *arena;
+};
+
+// constructor
+#define ROW_TREE_INIT(arena)                                                  \
+  {                                                                           \
+    NULL, arena                                                               \
+  }
+
+// Rows appended one after the other to a tree of their own, e.g. by a
+// thread loading part of a file, in O(1) each without any lookups. The
+// tree is then appended to a document as a whole. Builders share no
+// state.
+struct row_tree_builder
+{
+  struct row_tree tree;
+  struct row_node *last;
+  int count;
+};
+
+// constructor
+#define ROW_TREE_BUILDER_INIT(arena)                                          \
+  {                                                                           \
+    ROW_TREE_INIT (arena), NULL, 0                                            \
+  }
+
+int row_tree_size (const struct row_tree *tree);
+
+// Return the row at index AT or NULL if it is out of range.
+e_row *row_tree_at (const struct row_tree *tree, int at);
+
+// Bytes of text kept at most right behind a row, in the block of its node.
+#define ROW_TREE_INLINE 64
+
+// Link a new zeroed row at index AT and return it. Unless TEXT_SIZE is 0,
+// TEXT points to room for that many bytes behind the row if they fit in
+// ROW_TREE_INLINE, and CAPACITY tells how much there is.
+e_row *row_tree_insert (struct row_tree *tree, int at, int text_size);
+
+// Link a new zeroed row after the last one built and return it.
+e_row *row_tree_build (struct row_tree_builder *builder);
+
+// Finish building, rows can be looked up once it is done.
+void row_tree_build_end (struct row_tree_builder *builder);
+
+// Move the rows built to the end of TREE. Their nodes stay in the arena of
+// the builder, which has to be released along with the one of TREE.
+void row_tree_append_built (struct row_tree *tree,
+                            struct row_tree_builder *builder);
+
+// Unlink ROW from the tree and release its node. The row's own buffers are
+// expected to be freed by caller.
+void row_tree_remove (struct row_tree *tree, e_row *row);
+
+// Whether the text of ROW is the one kept behind it, which is released
+// along with the row.
+bool row_tree_text_inline (const e_row *row);
+
+// Forget every row at once, the nodes are released along with the arena.
+void row_tree_clear (struct row_tree *tree);
+
+int row_tree_index_of (const e_row *row);
+
+// Take in that the size or the screen lines of ROW changed.
+void row_tree_resized (e_row *row);
+
+// Take in that the rows changed all at once, in O(n).
+void row_tree_refresh (struct row_tree *tree);
+
+// Bytes of the rows before ROW, each followed by a newline, and of all
+// rows of TREE.
+long long row_tree_offset_of (const e_row *row);
+long long row_tree_bytes (const struct row_tree *tree);
+
+// Screen lines of the rows before ROW, and of all rows of TREE.
+int row_tree_line_of (const e_row *row);
+int row_tree_lines (const struct row_tree *tree);
+
+// Return the row that takes screen line LINE, and in FIRST the line it
+// starts at. NULL if LINE is out of range.
+e_row *row_tree_at_line (const struct row_tree *tree, int line, int *first);
+
+// In-order neighbours of ROW, NULL at either end of the document.
+e_row *row_tree_next (const e_row *row);
+e_row *row_tree_prev (const e_row *row);
+
+#endif
@@ -0,0 +1,295 @@
+#include "screen.h"
+#include "terminal.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Piece of a frame, either borrowed from a line or OFFSET bytes into the
+// control sequences of the frame when LINE is NULL.
+struct span
+{
+  const struct abuf *line;
+  int offset;
+  int len;
+};
+
+static struct
+{
+  int output;
+  int rows;
+  int cols;
+  struct abuf *front;
+  struct abuf *back;
+  // False when the terminal content is unknown, e.g. on start or resize.
+  bool valid;
+  int cursor_y;
+  int cursor_x;
+  // Control sequences that scroll the terminal, sent ahead of the next
+  // frame. FRONT is scrolled along right away.
+  struct abuf scroll;
+  // Buffers of the frame being flushed, kept across frames for reuse.
+  struct abuf control;
+  struct span *spans;
+  struct iovec *iov;
+  int num_spans;
+  int max_spans;
+  struct screen_stats stats;
+} S = { .output = STDOUT_FILENO };
+
+/***************** helpers ************************/
+
+static void
+lines_free (struct abuf *lines)
+{
+  for (int y = 0; y < S.rows; y++)
+    ab_free (&lines[y]);
+  free (lines);
+}
+
+static struct abuf *
+lines_new (int rows)
+{
+  struct abuf *lines = calloc (rows, sizeof (struct abuf));
+  if (lines == NULL)
+    die ("calloc");
+  return lines;
+}
+
+// Number of leading bytes that LINE shares with OLD, as long as they can be
+// skipped by moving the cursor, i.e. they are plain printable characters.
+static int
+common_prefix (const struct abuf *line, const struct abuf *old)
+{
+  int i = 0;
+  while (i < line->len && i < old->len && line->b[i] == old->b[i]
+         && line->b[i] >= ' ' && line->b[i] <= '~')
+    i++;
+  return i;
+}
+
+static bool
+is_plain (const struct abuf *line)
+{
+  for (int i = 0; i < line->len; i++)
+    if (line->b[i] < ' ' || line->b[i] > '~')
+      return false;
+  return true;
+}
+
+static void
+span_push (const struct abuf *line, int offset, int len)
+{
+  if (len == 0)
+    return;
+
+  // Merge consecutive control sequences into a single span.
+  struct span *last = S.num_spans ? &S.spans[S.num_spans - 1] : NULL;
+  if (line == NULL && last && last->line == NULL
+      && last->offset + last->len == offset)
+    {
+      last->len += len;
+      return;
+    }
+
+  S.spans[S.num_spans].line = line;
+  S.spans[S.num_spans].offset = offset;
+  S.spans[S.num_spans].len = len;
+  S.num_spans++;
+}
+
+static void
+control_append (const char *seq, int len)
+{
+  int offset = S.control.len;
+  ab_append (&S.control, seq, len);
+  span_push (NULL, offset, len);
+}
+
+static void
+move_cursor (int y, int x)
+{
+  int offset = S.control.len;
+
+  if (x == 0)
+    ab_appendf (&S.control, "\x1b[%dH", y + 1);
+  else
+    ab_appendf (&S.control, "\x1b[%d;%dH", y + 1, x + 1);
+  span_push (NULL, offset, S.control.len - offset);
+}
+
+// Move line FROM of FRONT to TO, leaving an empty line behind as the
+// terminal does when scrolling.
+static void
+line_move (int to, int from)
+{
+  struct abuf line = S.front[to];
+  S.front[to] = S.front[from];
+  S.front[from] = line;
+  ab_reset (&S.front[from]);
+}
+
+/***************** screen ************************/
+
+void
+screen_set_output (int fd)
+{
+  S.output = fd;
+  S.valid = false;
+}
+
+void
+screen_resize (int rows, int cols)
+{
+  if (S.front)
+    {
+      lines_free (S.front);
+      lines_free (S.back);
+    }
+
+  S.rows = rows;
+  S.cols = cols;
+  S.front = lines_new (rows);
+  S.back = lines_new (rows);
+  S.valid = false;
+
+  // Each line takes at most a cursor move, its text and a clear, plus the
+  // cursor handling around the frame.
+  S.max_spans = rows * 3 + 4;
+  free (S.spans);
+  free (S.iov);
+  S.spans = malloc (sizeof (struct span) * S.max_spans);
+  S.iov = malloc (sizeof (struct iovec) * S.max_spans);
+  if (S.spans == NULL || S.iov == NULL)
+    die ("malloc");
+}
+
+void
+screen_invalidate ()
+{
+  S.valid = false;
+  ab_reset (&S.scroll);
+}
+
+void
+screen_scroll (int top, int bottom, int n)
+{
+  int height = bottom - top;
+  if (!S.valid || n == 0 || n >= height || -n >= height)
+    return;
+
+  // Within a scroll region, a line feed on its last line scrolls it up and
+  // a reverse index on its first line scrolls it down. Both work on any
+  // VT100, unlike SU and SD, and lines scrolled in are blank.
+  ab_appendf (&S.scroll, "\x1b[%d;%dr", top + 1, bottom);
+  if (n > 0)
+    {
+      ab_appendf (&S.scroll, "\x1b[%dH", bottom);
+      ab_append_repeat (&S.scroll, '\n', n);
+      for (int y = top; y < bottom - n; y++)
+        line_move (y, y + n);
+    }
+  else
+    {
+      ab_appendf (&S.scroll, "\x1b[%dH", top + 1);
+      for (int i = 0; i < -n; i++)
+        ab_append (&S.scroll, "\x1bM", 2);
+      for (int y = bottom - 1; y >= top - n; y--)
+        line_move (y, y + n);
+    }
+  ab_append (&S.scroll, "\x1b[r", 3);
+}
+
+struct abuf *
+screen_line (int y)
+{
+  ab_reset (&S.back[y]);
+  return &S.back[y];
+}
+
+void
+screen_flush (int cursor_y, int cursor_x)
+{
+  ab_reset (&S.control);
+  S.num_spans = 0;
+
+  // Hide the cursor while painting
+  control_append ("\x1b[?25l", 6);
+
+  // Scrolling moves the cursor, which is placed anew afterwards.
+  bool painted = S.scroll.len > 0;
+  control_append (S.scroll.b, S.scroll.len);
+  ab_reset (&S.scroll);
+
+  for (int y = 0; y < S.rows; y++)
+    {
+      struct abuf *line = &S.back[y];
+      struct abuf *old = &S.front[y];
+
+      if (S.valid && line->len == old->len
+          && (line->len == 0 || memcmp (line->b, old->b, line->len) == 0))
+        continue;
+
+      int start = S.valid ? common_prefix (line, old) : 0;
+      move_cursor (y, start);
+      painted = true;
+      // Line text is handed to writev () as is, without another copy.
+      span_push (line, start, line->len - start);
+
+      // Clear the rest of the line unless the new text covers the old one.
+      if (!S.valid || line->len < old->len || !is_plain (line)
+          || !is_plain (old))
+        control_append ("\x1b[K", 3);
+    }
+
+  if (!painted)
+    {
+      ab_reset (&S.control);
+      S.num_spans = 0;
+    }
+
+  if (painted || cursor_y != S.cursor_y || cursor_x != S.cursor_x)
+    move_cursor (cursor_y, cursor_x);
+
+  if (painted)
+    control_append ("\x1b[?25h", 6);
+
+  // Control sequences are final now, so spans can be resolved.
+  int frame_bytes = 0;
+  for (int i = 0; i < S.num_spans; i++)
+    {
+      const struct span *span = &S.spans[i];
+      const char *base = span->line ? span->line->b : S.control.b;
+      S.iov[i].iov_base = (char *)&base[span->offset];
+      S.iov[i].iov_len = span->len;
+      frame_bytes += span->len;
+    }
+
+  if (S.num_spans)
+    ab_writev (S.output, S.iov, S.num_spans);
+
+  S.stats.frame_bytes = frame_bytes;
+  S.stats.frames++;
+  S.stats.total_bytes += frame_bytes;
+
+  // The composed frame is now what the terminal shows.
+  struct abuf *swap = S.front;
+  S.front = S.back;
+  S.back = swap;
+  S.valid = true;
+  S.cursor_y = cursor_y;
+  S.cursor_x = cursor_x;
+}
+
+void
+screen_clear ()
+{
+  write (S.output, "\x1b[2J\x1b[H", 7);
+  S.valid = false;
+}
+
+const struct screen_stats *
+screen_get_stats ()
+{
+  return &S.stats;
+}
@@ -0,0 +1,46 @@
+#ifndef SCREEN_H
+#define SCREEN_H
+
+#include "abuf.h"
+
+#include <stdbool.h>
+
+// The screen keeps a copy of what the terminal currently shows (front) next
+// to the frame being composed (back). Flushing a frame only sends the lines
+// that differ between the two, starting from their first changed column.
+
+struct screen_stats
+{
+  int frame_bytes;          // bytes written by the last flush
+  unsigned long frames;     // number of flushes
+  unsigned long total_bytes; // bytes written by all flushes
+};
+
+// Write frames to FD instead of the terminal.
+void screen_set_output (int fd);
+
+// (Re)allocate the screen to ROWS x COLS, next flush repaints every line.
+void screen_resize (int rows, int cols);
+
+// Forget what the terminal shows, next flush repaints every line.
+void screen_invalidate ();
+
+// Scroll lines TOP to BOTTOM - 1 of the terminal by N lines, up when N is
+// positive, as the content drawn there moved by as much. The lines that
+// stay in view are then not sent again by the next flush. Ignored while the
+// terminal content is unknown or when no line stays.
+void screen_scroll (int top, int bottom, int n);
+
+// Empty buffer that line Y of the next frame is drawn into.
+struct abuf *screen_line (int y);
+
+// Send the differences of the composed frame to the terminal and place the
+// cursor at (Y, X), zero based.
+void screen_flush (int cursor_y, int cursor_x);
+
+// Clear the terminal and home the cursor, e.g. on exit.
+void screen_clear ();
+
+const struct screen_stats *screen_get_stats ();
+
+#endif
@@ -0,0 +1,264 @@
+#include "search.h"
+#include "terminal.h"
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+/***************** helpers ************************/
+
+// Order of (Y, X) in the run of a document of ROWS rows.
+static long long
+run_key (const struct search *search, int rows, int y, int x)
+{
+  long long row = (y - search->first + rows) % rows;
+  return row << 32 | (unsigned int)x;
+}
+
+// Index of the first match at or after (Y, X).
+static int
+lower_bound (const struct search *search, int rows, int y, int x)
+{
+  const struct search_match *matches = &search->matches[search->head];
+  long long key = run_key (search, rows, y, x);
+  int low = 0, high = search->num_matches;
+
+  while (low < high)
+    {
+      int mid = low + (high - low) / 2;
+      if (run_key (search, rows, matches[mid].y, matches[mid].x) < key)
+        low = mid + 1;
+      else
+        high = mid;
+    }
+
+  return low;
+}
+
+// Make room for FRONT more matches before the stored ones and BACK more
+// after them. The matches are moved to the middle of what is left.
+static void
+reserve_matches (struct search *search, int front, int back)
+{
+  int tail = search->capacity - search->head - search->num_matches;
+  if (search->head >= front && tail >= back)
+    return;
+
+  int needed = search->num_matches + front + back;
+  struct search_match *matches = search->matches;
+  if (search->capacity < needed * 2)
+    {
+      search->capacity = needed * 2 > 64 ? needed * 2 : 64;
+      matches = malloc (sizeof (struct search_match) * search->capacity);
+      if (matches == NULL)
+        die ("malloc");
+    }
+
+  int head = front + (search->capacity - needed) / 2;
+  if (search->num_matches)
+    memmove (&matches[head], &search->matches[search->head],
+             sizeof (struct search_match) * search->num_matches);
+  if (matches != search->matches)
+    {
+      free (search->matches);
+      search->matches = matches;
+    }
+  search->head = head;
+}
+
+// Append a match and return it.
+static struct search_match *
+append_match (struct search *search)
+{
+  reserve_matches (search, 0, 1);
+  return &search->matches[search->head + search->num_matches++];
+}
+
+// Store the matches of ROW, which is row Y, after the others or in front
+// of them if FRONT, and return how many there were.
+static int
+scan_row (struct search *search, const e_row *row, int y, bool front)
+{
+  const char *pattern = search->pattern.b;
+  int len = search->pattern.len;
+  int before = search->num_matches;
+
+  for (int x = search_find (row->text, row->size, pattern, len, 0); x != -1;
+       x = search_find (row->text, row->size, pattern, len, x + 1))
+    {
+      struct search_match *match = append_match (search);
+      match->y = y;
+      match->x = x;
+    }
+
+  // Matches in front are appended too and then moved ahead of the others.
+  int count = search->num_matches - before;
+  if (count && front && before)
+    {
+      reserve_matches (search, count, 0);
+      struct search_match *matches = &search->matches[search->head];
+      memcpy (matches - count, &matches[before],
+              sizeof (struct search_match) * count);
+      search->head -= count;
+    }
+
+  return count;
+}
+
+// Extend the run by the rows after it, up to the first one that has a
+// match or until it covers all ROWS rows.
+static void
+scan_forward (struct search *search, const struct row_tree *tree, int rows)
+{
+  int y = (search->first + search->count) % rows;
+  const e_row *row = row_tree_at (tree, y);
+
+  while (search->count < rows)
+    {
+      search->count++;
+      if (scan_row (search, row, y, false))
+        return;
+
+      row = row_tree_next (row);
+      y++;
+      if (row == NULL)
+        {
+          y = 0;
+          row = row_tree_at (tree, 0);
+        }
+    }
+}
+
+// Same as scan_forward () for the rows before the run.
+static void
+scan_backward (struct search *search, const struct row_tree *tree, int rows)
+{
+  int y = (search->first - 1 + rows) % rows;
+  const e_row *row = row_tree_at (tree, y);
+
+  while (search->count < rows)
+    {
+      search->first = y;
+      search->count++;
+      if (scan_row (search, row, y, true))
+        return;
+
+      row = row_tree_prev (row);
+      y--;
+      if (row == NULL)
+        {
+          y = rows - 1;
+          row = row_tree_at (tree, y);
+        }
+    }
+}
+
+/***************** search ************************/
+
+int
+search_find (const char *text, int size, const char *pattern, int len,
+             int from)
+{
+  if (len == 0)
+    return -1;
+
+  // Candidates are found by their first byte with memchr (), which looks at
+  // whole words at a time, and only those are compared in full.
+  const char *end = text + size;
+  const char *p = text + from;
+
+  while (end - p >= len)
+    {
+      p = memchr (p, pattern[0], end - p - len + 1);
+      if (p == NULL)
+        return -1;
+      if (memcmp (p + 1, pattern + 1, len - 1) == 0)
+        return p - text;
+      p++;
+    }
+
+  return -1;
+}
+
+void
+search_set_pattern (struct search *search, const char *pattern, int len)
+{
+  // Reopening a search keeps what was found so far.
+  if (len == search->pattern.len
+      && (len == 0 || memcmp (pattern, search->pattern.b, len) == 0))
+    return;
+
+  ab_reset (&search->pattern);
+  ab_append (&search->pattern, pattern, len);
+  search_reset (search);
+}
+
+void
+search_reset (struct search *search)
+{
+  search->num_matches = 0;
+  search->head = search->capacity / 2;
+  search->count = 0;
+}
+
+const struct search_match *
+search_next (struct search *search, const struct row_tree *tree, int y,
+             int x, bool backward)
+{
+  int rows = row_tree_size (tree);
+  if (search->pattern.len == 0 || rows == 0)
+    return NULL;
+
+  // Past the last row is the same as the end of it.
+  if (y >= rows)
+    {
+      y = rows - 1;
+      x = INT_MAX;
+    }
+
+  // Start a new run at Y unless it is part of the current one.
+  if (search->count == 0 || (y - search->first + rows) % rows >= search->count)
+    {
+      search_reset (search);
+      search->first = y;
+      search->count = 1;
+      scan_row (search, row_tree_at (tree, y), y, false);
+    }
+
+  while (true)
+    {
+      int i = lower_bound (search, rows, y, x);
+      if (!backward && i < search->num_matches)
+        return &search->matches[search->head + i];
+      if (backward && i > 0)
+        return &search->matches[search->head + i - 1];
+
+      if (search->count == rows)
+        break;
+
+      if (backward)
+        scan_backward (search, tree, rows);
+      else
+        scan_forward (search, tree, rows);
+    }
+
+  // Every row has been scanned, wrap around.
+  if (search->num_matches == 0)
+    return NULL;
+  const struct search_match *matches = &search->matches[search->head];
+  return backward ? &matches[search->num_matches - 1] : &matches[0];
+}
+
+// desctructor
+void
+search_free (struct search *search)
+{
+  ab_free (&search->pattern);
+  free (search->matches);
+  search->matches = NULL;
+  search->head = 0;
+  search->num_matches = 0;
+  search->capacity = 0;
+  search->count = 0;
+  search->active = false;
+}
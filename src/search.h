@@ -0,0 +1,64 @@
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include "abuf.h"
+#include "row_tree.h"
+
+#include <stdbool.h>
+
+// Matches of a search pattern are looked up lazily: rows are only scanned
+// as far as needed to find the next match, and the matches of every row
+// scanned so far are kept so that stepping through them does not scan the
+// rows again. The scanned rows are a single run that starts at the row the
+// search started from and may wrap around the end of the document.
+
+struct search_match
+{
+  int y, x;
+};
+
+struct search
+{
+  struct abuf pattern;
+  // Matches in the rows scanned so far, in the order of the run, from
+  // index HEAD of MATCHES on. There is room left on both ends as the run
+  // grows either way.
+  struct search_match *matches;
+  int head;
+  int num_matches;
+  int capacity;
+  // The run is COUNT rows long and starts at row FIRST.
+  int first;
+  int count;
+  // Matches are highlighted on screen while the search prompt is open.
+  bool active;
+};
+
+// constructor
+#define SEARCH_INIT                                                           \
+  {                                                                           \
+    ABUF_INIT, NULL, 0, 0, 0, 0, 0, false                                     \
+  }
+
+// desctructor
+void search_free (struct search *search);
+
+// Offset of the first occurrence of the LEN bytes of PATTERN in the SIZE
+// bytes of TEXT at or after FROM, -1 if there is none.
+int search_find (const char *text, int size, const char *pattern, int len,
+                 int from);
+
+// Look for PATTERN from now on.
+void search_set_pattern (struct search *search, const char *pattern,
+                         int len);
+
+// Forget the matches found so far, e.g. because the document changed.
+void search_reset (struct search *search);
+
+// Return the first match at or after (Y, X), or the last one before it if
+// BACKWARD, wrapping around the ends of TREE. NULL if there is none.
+const struct search_match *search_next (struct search *search,
+                                        const struct row_tree *tree, int y,
+                                        int x, bool backward);
+
+#endif
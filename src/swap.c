@@ -0,0 +1,391 @@
+// feature test macros
+#define _GNU_SOURCE
+
+#include "swap.h"
+#include "terminal.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+// macOS names the nanoseconds of the times in struct stat differently.
+#ifdef __APPLE__
+#define st_mtim st_mtimespec
+#endif
+
+#define SWAP_MAGIC "JATESWP2"
+
+// Start of a swap file, identifying the file it applies to.
+struct swap_header
+{
+  char magic[8];
+  long long size;
+  long long mtime_sec;
+  long long mtime_nsec;
+};
+
+// Every edit is stored as this followed by its LEN bytes of text.
+struct swap_entry
+{
+  int kind;
+  int y, x;
+  int len;
+};
+
+// The text of a SWAP_TAIL edit is this, followed by the LEN bytes of the
+// rows.
+struct swap_tail
+{
+  // Byte of the file the rows are written from.
+  long long offset;
+  long long len;
+};
+
+/***************** helpers ************************/
+
+static long long
+now_ms ()
+{
+  struct timespec now;
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000LL + now.tv_nsec / 1000000;
+}
+
+// Fill in the header of a swap file for TARGET as it is on disk, false if
+// it can't be looked up.
+static bool
+make_header (const char *target, struct swap_header *header)
+{
+  struct stat st;
+  if (stat (target, &st) == -1)
+    return false;
+
+  memset (header, 0, sizeof (struct swap_header));
+  memcpy (header->magic, SWAP_MAGIC, sizeof (header->magic));
+  header->size = st.st_size;
+  header->mtime_sec = st.st_mtim.tv_sec;
+  header->mtime_nsec = st.st_mtim.tv_nsec;
+  return true;
+}
+
+// LEAK WARNING: the returned path is expected to free by caller
+static char *
+make_path (const char *target)
+{
+  const char *slash = strrchr (target, '/');
+  int dir_length = slash ? slash - target + 1 : 0;
+  const char *base = slash ? slash + 1 : target;
+
+  size_t length = strlen (target) + sizeof ("..swp");
+  char *path = malloc (length);
+  if (path == NULL)
+    die ("malloc");
+  snprintf (path, length, "%.*s.%s.swp", dir_length, target, base);
+  return path;
+}
+
+// Read the whole swap file open as FD into a buffer of SIZE bytes.
+static char *
+read_journal (int fd, size_t *size)
+{
+  struct stat st;
+  if (fstat (fd, &st) == -1)
+    return NULL;
+
+  char *journal = malloc (st.st_size ? st.st_size : 1);
+  if (journal == NULL)
+    die ("malloc");
+
+  size_t total = 0;
+  while (total < (size_t)st.st_size)
+    {
+      ssize_t n = pread (fd, journal + total, st.st_size - total, total);
+      if (n <= 0)
+        break;
+      total += n;
+    }
+
+  *size = total;
+  return journal;
+}
+
+// Find the whole edits of the SIZE bytes of JOURNAL: the end of the last
+// one is stored in END, and the start of the last SWAP_TAIL edit, if any,
+// in TAIL.
+static void
+scan_journal (const char *journal, size_t size, size_t *end, size_t *tail)
+{
+  size_t at = sizeof (struct swap_header);
+  *tail = 0;
+  while (at + sizeof (struct swap_entry) <= size)
+    {
+      struct swap_entry entry;
+      memcpy (&entry, journal + at, sizeof (entry));
+
+      // A crash may have cut the last edit short.
+      size_t left = size - at - sizeof (struct swap_entry);
+      if (entry.kind < UNDO_INSERT || entry.kind > (int)SWAP_TAIL
+          || entry.len < 0 || (size_t)entry.len > left
+          || (entry.kind == (int)SWAP_TAIL
+              && entry.len != sizeof (struct swap_tail)))
+        break;
+
+      size_t length = entry.len;
+      if (entry.kind == (int)SWAP_TAIL)
+        {
+          struct swap_tail record;
+          memcpy (&record, journal + at + sizeof (entry), sizeof (record));
+          if (record.len < 0
+              || (unsigned long long)record.len > left - entry.len)
+            break;
+          length += record.len;
+          *tail = at;
+        }
+      at += sizeof (struct swap_entry) + length;
+    }
+  *end = at;
+}
+
+// Write out the pending edits, creating the swap file first if need be.
+static bool
+write_pending (struct swap *swap)
+{
+  struct swap_header header;
+  if (swap->fd == -1)
+    {
+      if (!make_header (swap->target, &header))
+        return false;
+      swap->fd = open (swap->path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND,
+                       0600);
+      if (swap->fd == -1
+          || write (swap->fd, &header, sizeof (header)) != sizeof (header))
+        return false;
+    }
+
+  struct iovec iov = { swap->pending.b, swap->pending.len };
+  if (ab_writev (swap->fd, &iov, 1) == -1)
+    return false;
+
+  ab_reset (&swap->pending);
+  return true;
+}
+
+// A swap file with edits missing can't be replayed, stop journaling.
+static bool
+give_up (struct swap *swap)
+{
+  int saved_errno = errno;
+  swap_discard (swap);
+  swap->active = false;
+  errno = saved_errno;
+  return false;
+}
+
+/***************** swap ************************/
+
+void
+swap_open (struct swap *swap, const char *file_name)
+{
+  swap->target = strdup (file_name);
+  swap->path = make_path (file_name);
+  swap->fd = -1;
+  swap->active = true;
+}
+
+bool
+swap_recoverable (const struct swap *swap)
+{
+  struct swap_header expected, header;
+  if (swap->path == NULL || !make_header (swap->target, &expected))
+    return false;
+
+  int fd = open (swap->path, O_RDONLY);
+  if (fd == -1)
+    return false;
+
+  size_t size;
+  char *journal = read_journal (fd, &size);
+  struct stat st;
+  bool ok = journal && fstat (fd, &st) == 0
+            && size > sizeof (struct swap_header);
+  close (fd);
+  if (!ok)
+    {
+      free (journal);
+      return false;
+    }
+  memcpy (&header, journal, sizeof (header));
+
+  // It has to hold edits, made after the file was last written.
+  bool recoverable
+      = (st.st_mtim.tv_sec > expected.mtime_sec
+         || (st.st_mtim.tv_sec == expected.mtime_sec
+             && st.st_mtim.tv_nsec >= expected.mtime_nsec))
+        && memcmp (&header, &expected, sizeof (header)) == 0;
+
+  // Or the file was written in place after it, which leaves the bytes
+  // before the rows written alone.
+  size_t end, tail;
+  scan_journal (journal, size, &end, &tail);
+  if (!recoverable && tail
+      && memcmp (header.magic, SWAP_MAGIC, sizeof (header.magic)) == 0)
+    {
+      struct swap_tail record;
+      memcpy (&record, journal + tail + sizeof (struct swap_entry),
+              sizeof (record));
+      recoverable = record.offset <= expected.size;
+    }
+
+  free (journal);
+  return recoverable;
+}
+
+int
+swap_replay (struct swap *swap, swap_apply apply)
+{
+  int fd = open (swap->path, O_RDWR | O_APPEND);
+  if (fd == -1)
+    return 0;
+
+  size_t size;
+  char *journal = read_journal (fd, &size);
+  if (journal == NULL)
+    {
+      close (fd);
+      return 0;
+    }
+
+  // The edits replayed are in the swap file already.
+  bool active = swap->active;
+  swap->active = false;
+
+  // The rows of a save in place stand for every edit before them.
+  size_t end, at;
+  scan_journal (journal, size, &end, &at);
+  if (at == 0)
+    at = sizeof (struct swap_header);
+
+  int count = 0;
+  while (at < end)
+    {
+      struct swap_entry entry;
+      memcpy (&entry, journal + at, sizeof (entry));
+      const char *text = journal + at + sizeof (struct swap_entry);
+      long long len = entry.len;
+      if (entry.kind == (int)SWAP_TAIL)
+        {
+          struct swap_tail record;
+          memcpy (&record, text, sizeof (record));
+          text += sizeof (record);
+          len = record.len;
+        }
+
+      apply (entry.kind, entry.y, entry.x, text, len);
+      at = text + len - journal;
+      count++;
+    }
+
+  swap->active = active;
+  free (journal);
+
+  // New edits follow the last whole one.
+  if (ftruncate (fd, end) == -1)
+    {
+      close (fd);
+      return count;
+    }
+
+  swap->fd = fd;
+  return count;
+}
+
+void
+swap_record (struct swap *swap, enum undo_kind kind, int y, int x,
+             const char *text, int len)
+{
+  if (!swap->active)
+    return;
+
+  struct swap_entry entry = { kind, y, x, len };
+  long long now = now_ms ();
+  if (swap->pending.len == 0)
+    swap->due = now + SWAP_FLUSH_INTERVAL;
+
+  ab_append (&swap->pending, (const char *)&entry, sizeof (entry));
+  ab_append (&swap->pending, text, len);
+
+  // Keep to the interval while edits come in without a pause.
+  if (now >= swap->due)
+    swap_flush (swap);
+}
+
+bool
+swap_record_tail (struct swap *swap, int y, long long offset,
+                  long long len, swap_write write_text, const void *data)
+{
+  if (!swap->active)
+    return false;
+
+  // The edits pending go out first, the rows are written right after them.
+  struct swap_tail record = { offset, len };
+  struct swap_entry entry = { SWAP_TAIL, y, 0, (int)sizeof (record) };
+  ab_append (&swap->pending, (const char *)&entry, sizeof (entry));
+  ab_append (&swap->pending, (const char *)&record, sizeof (record));
+
+  if (write_pending (swap) && write_text (swap->fd, data) == len
+      && fdatasync (swap->fd) != -1)
+    return true;
+  return give_up (swap);
+}
+
+int
+swap_timeout (const struct swap *swap)
+{
+  if (swap->pending.len == 0)
+    return -1;
+
+  long long left = swap->due - now_ms ();
+  return left > 0 ? left : 0;
+}
+
+bool
+swap_flush (struct swap *swap)
+{
+  if (swap->pending.len == 0)
+    return true;
+
+  if (write_pending (swap) && fdatasync (swap->fd) != -1)
+    return true;
+  return give_up (swap);
+}
+
+void
+swap_discard (struct swap *swap)
+{
+  // Only a swap file of our own is removed, not one left behind.
+  if (swap->fd != -1)
+    {
+      close (swap->fd);
+      unlink (swap->path);
+      swap->fd = -1;
+    }
+
+  ab_reset (&swap->pending);
+}
+
+// desctructor
+void
+swap_free (struct swap *swap)
+{
+  swap_discard (swap);
+  ab_free (&swap->pending);
+  free (swap->target);
+  free (swap->path);
+  *swap = (struct swap)SWAP_INIT;
+}
@@ -0,0 +1,94 @@
+#ifndef SWAP_H
+#define SWAP_H
+
+#include "abuf.h"
+#include "undo.h"
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+// Journal of the edits made since a file was last saved, kept in a swap
+// file next to it so that they survive a crash. Edits are appended in the
+// delta format of undo.h, one per row operation, and written out in
+// batches: the first edit after a write starts a timer and everything
+// journaled until it expires is written and synced at once. The swap file
+// records the size and modification time of the file it applies to, and
+// is only replayed onto that very file, or onto the one a save in place
+// left after a SWAP_TAIL edit.
+
+// Milliseconds edits may wait in memory before they are written out.
+#define SWAP_FLUSH_INTERVAL 1000
+
+// Kind of the edit journaled right before a save rewrites the file in
+// place from row Y on, TEXT being those rows each followed by a newline.
+// Replaying it puts them back whether the write was done, cut short or
+// not started, and the edits before it are left out. Its text is streamed
+// to the swap file rather than kept in memory, and may be larger than an
+// int.
+#define SWAP_TAIL ((enum undo_kind)(UNDO_DELETE_ROW + 1))
+
+struct swap
+{
+  // File the journal applies to and the swap file, which is only created
+  // by the first edit.
+  char *target;
+  char *path;
+  int fd;
+  // Edits not written out yet, due by CLOCK_MONOTONIC millisecond DUE.
+  struct abuf pending;
+  long long due;
+  // Edits are journaled while set.
+  bool active;
+};
+
+// constructor
+#define SWAP_INIT                                                             \
+  {                                                                           \
+    NULL, NULL, -1, ABUF_INIT, 0, false                                       \
+  }
+
+// Called with every edit read back from a swap file.
+typedef void (*swap_apply) (enum undo_kind kind, int y, int x,
+                            const char *text, long long len);
+
+// Called to write the text of a SWAP_TAIL edit to FILE_DESCRIPTOR, returns
+// the bytes written or -1.
+typedef ssize_t (*swap_write) (int file_descriptor, const void *data);
+
+// Journal the edits made to FILE_NAME from now on.
+void swap_open (struct swap *swap, const char *file_name);
+
+// desctructor, the swap file is removed.
+void swap_free (struct swap *swap);
+
+// Whether a swap file left behind applies to the file as it is on disk.
+bool swap_recoverable (const struct swap *swap);
+
+// Hand the edits of the swap file to APPLY, from the last SWAP_TAIL one on
+// if there is any, and return how many there were.
+// Journaling goes on at the end of the swap file.
+int swap_replay (struct swap *swap, swap_apply apply);
+
+// Journal that TEXT was inserted or deleted at (Y, X), see undo.h
+void swap_record (struct swap *swap, enum undo_kind kind, int y, int x,
+                  const char *text, int len);
+
+// Journal and sync, before the file is written in place from byte OFFSET
+// on, that the rows from Y on are the LEN bytes that WRITE_TEXT writes
+// given DATA. False if that failed, and the file must then not be written
+// in place.
+bool swap_record_tail (struct swap *swap, int y, long long offset,
+                       long long len, swap_write write_text,
+                       const void *data);
+
+// Milliseconds until edits have to be written out, -1 if there are none.
+int swap_timeout (const struct swap *swap);
+
+// Write out and sync the pending edits, false if that failed.
+bool swap_flush (struct swap *swap);
+
+// Remove the swap file, e.g. once the file has been saved. Edits made
+// after that start a new one.
+void swap_discard (struct swap *swap);
+
+#endif
@@ -0,0 +1,243 @@
+#include "syntax.h"
+
+#include <ctype.h>
+#include <stddef.h>
+#include <string.h>
+
+/***************** syntax database ************************/
+
+static const char *const c_extensions[]
+    = { ".c", ".h", ".cc", ".cpp", ".cxx", ".hh", ".hpp", ".hxx", NULL };
+
+static const char *const c_keywords[] = {
+  "NULL", "alignas", "alignof", "asm", "auto", "break", "case", "catch",
+  "class", "const", "const_cast", "constexpr", "continue", "decltype",
+  "default", "delete", "do", "dynamic_cast", "else", "enum", "explicit",
+  "export", "extern", "false", "for", "friend", "goto", "if", "inline",
+  "mutable", "namespace", "new", "noexcept", "nullptr", "operator", "private",
+  "protected", "public", "register", "reinterpret_cast", "return", "sizeof",
+  "static", "static_assert", "static_cast", "struct", "switch", "template",
+  "this", "throw", "true", "try", "typedef", "typeid", "typename", "union",
+  "using", "virtual", "volatile", "while",
+};
+
+static const char *const c_types[] = {
+  "bool", "char", "char16_t", "char32_t", "double", "float", "int", "int16_t",
+  "int32_t", "int64_t", "int8_t", "long", "short", "signed", "size_t",
+  "ssize_t", "uint16_t", "uint32_t", "uint64_t", "uint8_t", "unsigned",
+  "void", "wchar_t",
+};
+
+#define COUNT(array) ((int)(sizeof (array) / sizeof ((array)[0])))
+
+static const struct syntax syntax_db[] = {
+  { "C/C++", c_extensions, c_keywords, COUNT (c_keywords), c_types,
+    COUNT (c_types) },
+};
+
+/***************** helpers ************************/
+
+static bool
+is_separator (int c)
+{
+  return isspace (c) || c == '\0' || strchr (",.()+-/*=~%<>[];{}&|^!?:", c);
+}
+
+static bool
+is_word (int c)
+{
+  return isalnum (c) || c == '_';
+}
+
+// Whether the LEN characters of WORD are one of the COUNT sorted entries of
+// LIST.
+static bool
+in_list (const char *const *list, int count, const char *word, int len)
+{
+  int low = 0, high = count - 1;
+
+  while (low <= high)
+    {
+      int mid = (low + high) / 2;
+      int cmp = strncmp (word, list[mid], len);
+      // WORD is a proper prefix of the entry, so it sorts before it.
+      if (cmp == 0 && list[mid][len] != '\0')
+        cmp = -1;
+
+      if (cmp == 0)
+        return true;
+      if (cmp < 0)
+        high = mid - 1;
+      else
+        low = mid + 1;
+    }
+
+  return false;
+}
+
+static void
+mark (unsigned char *hl, int from, int to, enum highlight class)
+{
+  if (hl)
+    memset (&hl[from], class, to - from);
+}
+
+/***************** syntax ************************/
+
+const struct syntax *
+syntax_select (const char *file_name)
+{
+  if (file_name == NULL)
+    return NULL;
+
+  const char *ext = strrchr (file_name, '.');
+  if (ext == NULL)
+    return NULL;
+
+  for (int i = 0; i < COUNT (syntax_db); i++)
+    for (const char *const *e = syntax_db[i].extensions; *e; e++)
+      if (strcmp (ext, *e) == 0)
+        return &syntax_db[i];
+
+  return NULL;
+}
+
+enum syntax_state
+syntax_lex (const struct syntax *syntax, const char *text, int size,
+            unsigned char *hl, enum syntax_state state)
+{
+  int i = 0;
+
+  // Only whitespace may precede a preprocessor directive.
+  bool line_start = true;
+  // Numbers and words only start after a separator.
+  bool separated = true;
+
+  while (i < size)
+    {
+      int start = i;
+      char c = text[i];
+
+      if (state == SYNTAX_COMMENT)
+        {
+          while (i < size
+                 && !(text[i] == '*' && i + 1 < size && text[i + 1] == '/'))
+            i++;
+          if (i < size)
+            {
+              i += 2;
+              state = SYNTAX_NORMAL;
+            }
+          mark (hl, start, i, HL_COMMENT);
+          separated = true;
+          continue;
+        }
+
+      if (c == '/' && i + 1 < size && text[i + 1] == '/')
+        {
+          mark (hl, i, size, HL_COMMENT);
+          break;
+        }
+
+      if (c == '/' && i + 1 < size && text[i + 1] == '*')
+        {
+          // Skip the opening so that "/*/" does not close itself.
+          mark (hl, i, i + 2, HL_COMMENT);
+          i += 2;
+          state = SYNTAX_COMMENT;
+          line_start = false;
+          continue;
+        }
+
+      if (c == '"' || c == '\'')
+        {
+          i++;
+          while (i < size && text[i] != c)
+            i += (text[i] == '\\' && i + 1 < size) ? 2 : 1;
+          if (i < size)
+            i++;
+          mark (hl, start, i, HL_STRING);
+          line_start = false;
+          separated = true;
+          continue;
+        }
+
+      if (c == '#' && line_start)
+        {
+          i++;
+          while (i < size && isspace ((unsigned char)text[i]))
+            i++;
+          while (i < size && is_word ((unsigned char)text[i]))
+            i++;
+          mark (hl, start, i, HL_PREPROC);
+          line_start = false;
+          separated = true;
+          continue;
+        }
+
+      if (separated && isdigit ((unsigned char)c))
+        {
+          // Digits with hexadecimal letters, suffixes, exponents and
+          // digit separators.
+          while (i < size
+                 && (is_word ((unsigned char)text[i]) || text[i] == '.'
+                     || text[i] == '\''
+                     || ((text[i] == '+' || text[i] == '-')
+                         && text[i - 1] && strchr ("eEpP", text[i - 1]))))
+            i++;
+          mark (hl, start, i, HL_NUMBER);
+          line_start = false;
+          separated = false;
+          continue;
+        }
+
+      if (separated && is_word ((unsigned char)c))
+        {
+          while (i < size && is_word ((unsigned char)text[i]))
+            i++;
+
+          enum highlight class = HL_NORMAL;
+          if (in_list (syntax->keywords, syntax->num_keywords, &text[start],
+                       i - start))
+            class = HL_KEYWORD;
+          else if (in_list (syntax->types, syntax->num_types, &text[start],
+                            i - start))
+            class = HL_TYPE;
+
+          mark (hl, start, i, class);
+          line_start = false;
+          separated = false;
+          continue;
+        }
+
+      mark (hl, i, i + 1, HL_NORMAL);
+      if (!isspace ((unsigned char)c))
+        line_start = false;
+      separated = is_separator ((unsigned char)c);
+      i++;
+    }
+
+  return state;
+}
+
+int
+syntax_color (enum highlight hl)
+{
+  switch (hl)
+    {
+    case HL_COMMENT:
+      return 36;
+    case HL_KEYWORD:
+      return 33;
+    case HL_TYPE:
+      return 32;
+    case HL_STRING:
+      return 35;
+    case HL_NUMBER:
+      return 31;
+    case HL_PREPROC:
+      return 34;
+    default:
+      return 39;
+    }
+}
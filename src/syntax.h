@@ -0,0 +1,53 @@
+#ifndef SYNTAX_H
+#define SYNTAX_H
+
+#include <stdbool.h>
+
+// Highlight class of each rendered character.
+enum highlight
+{
+  HL_NORMAL = 0,
+  HL_COMMENT,
+  HL_KEYWORD,
+  HL_TYPE,
+  HL_STRING,
+  HL_NUMBER,
+  HL_PREPROC,
+  // Search match, drawn in reverse video over the default color.
+  HL_MATCH,
+};
+
+// Lexer state at the end of a row, which the next row starts in.
+enum syntax_state
+{
+  SYNTAX_NORMAL = 0,
+  // Inside a /* block comment */.
+  SYNTAX_COMMENT,
+};
+
+struct syntax
+{
+  const char *name;
+  // NULL terminated list of file name suffixes.
+  const char *const *extensions;
+  // Both lists are sorted as by strcmp () for lookup by binary search.
+  const char *const *keywords;
+  int num_keywords;
+  const char *const *types;
+  int num_types;
+};
+
+// Pick the syntax of FILE_NAME by its extension, NULL if there is none.
+const struct syntax *syntax_select (const char *file_name);
+
+// Lex the SIZE characters of TEXT starting in STATE and return the state at
+// their end. The class of every character is stored into HL unless it is
+// NULL, which only computes the state.
+enum syntax_state syntax_lex (const struct syntax *syntax, const char *text,
+                              int size, unsigned char *hl,
+                              enum syntax_state state);
+
+// SGR foreground color of HL.
+int syntax_color (enum highlight hl);
+
+#endif
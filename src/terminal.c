@@ -3,6 +3,7 @@
 
 #include <ctype.h>
 #include <errno.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/ioctl.h>
@@ -25,6 +26,7 @@ die (const char *s)
 void
 disable_raw_mode ()
 {
+  write (STDOUT_FILENO, "\x1b[?2004l", 8);
   if (tcsetattr (STDIN_FILENO, TCSAFLUSH, &E.orig_termios) == -1)
     die ("tcsetattr");
 }
@@ -47,12 +49,15 @@ enable_raw_mode ()
   raw.c_cflag |= (CS8);
   raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
 
-  // To set up timeout for input.
+  // Never block in read (), waiting for input is left to poll ().
   raw.c_cc[VMIN] = 0;
-  raw.c_cc[VTIME] = 1;
+  raw.c_cc[VTIME] = 0;
 
   if (tcsetattr (STDIN_FILENO, TCSAFLUSH, &raw) == -1)
     die ("tcgetattr");
+
+  // Have pastes wrapped in "ESC [ 200 ~" and "ESC [ 201 ~".
+  write (STDOUT_FILENO, "\x1b[?2004h", 8);
 }
 
 int
@@ -66,6 +71,9 @@ get_cursor_position (int *rows, int *cols)
 
   while (i < sizeof (buf) - 1)
     {
+      struct pollfd pfd = { STDIN_FILENO, POLLIN, 0 };
+      if (poll (&pfd, 1, 1000) != 1)
+        break;
       if (read (STDIN_FILENO, &buf[i], 1) != 1)
         break;
       else if (buf[i] == 'R')
@@ -0,0 +1,166 @@
+// feature test macros
+#define _GNU_SOURCE
+
+#include "trace.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+static struct
+{
+  // Trace file, NULL unless tracing, and whether an event was written.
+  FILE *file;
+  bool started;
+  int pid;
+  // Keys handled since the last frame, the time the first of them arrived
+  // and the system calls counted up to that frame.
+  int keys;
+  long long input_since;
+  unsigned long syscalls;
+  unsigned long frame_syscalls;
+  struct trace_stats stats;
+} T = { NULL, false, 0, 0, 0, 0, 0, { 0, 0, 0 } };
+
+/***************** helpers ************************/
+
+// Start an event of phase PH at TS, its fields are left open.
+static void
+event_begin (const char *name, const char *ph, long long ts)
+{
+  fputs (T.started ? ",\n" : "[\n", T.file);
+  T.started = true;
+  fprintf (T.file,
+           "{\"name\":\"%s\",\"ph\":\"%s\",\"ts\":%lld,\"pid\":%d,\"tid\":1",
+           name, ph, ts, T.pid);
+}
+
+// Close the event with its "args" printed from FMT, if any.
+static void
+event_end (const char *fmt, va_list ap)
+{
+  if (fmt)
+    {
+      fputs (",\"args\":{", T.file);
+      vfprintf (T.file, fmt, ap);
+      fputc ('}', T.file);
+    }
+  fputc ('}', T.file);
+}
+
+// The array of events may be left open, a crash still leaves a trace.
+static void
+trace_close ()
+{
+  if (T.file == NULL)
+    return;
+
+  fputs ("\n]\n", T.file);
+  fclose (T.file);
+  T.file = NULL;
+}
+
+/***************** trace ************************/
+
+bool
+trace_open (const char *file_name)
+{
+  T.file = fopen (file_name, "w");
+  if (T.file == NULL)
+    return false;
+
+  T.pid = getpid ();
+  atexit (trace_close);
+  return true;
+}
+
+bool
+trace_active ()
+{
+  return T.file != NULL;
+}
+
+long long
+trace_now_us ()
+{
+  struct timespec now;
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000000LL + now.tv_nsec / 1000;
+}
+
+long long
+trace_span (const char *name, long long start, const char *fmt, ...)
+{
+  long long duration = trace_now_us () - start;
+  if (T.file == NULL)
+    return duration;
+
+  event_begin (name, "X", start);
+  fprintf (T.file, ",\"dur\":%lld", duration);
+
+  va_list ap;
+  va_start (ap, fmt);
+  event_end (fmt, ap);
+  va_end (ap);
+  return duration;
+}
+
+void
+trace_counter (const char *name, const char *fmt, ...)
+{
+  if (T.file == NULL)
+    return;
+
+  event_begin (name, "C", trace_now_us ());
+
+  va_list ap;
+  va_start (ap, fmt);
+  event_end (fmt, ap);
+  va_end (ap);
+}
+
+void
+trace_syscall ()
+{
+  T.syscalls++;
+}
+
+void
+trace_input ()
+{
+  if (T.input_since == 0)
+    T.input_since = trace_now_us ();
+}
+
+void
+trace_key ()
+{
+  T.keys++;
+}
+
+void
+trace_frame (long long start, int bytes)
+{
+  T.stats.refresh_us = trace_span ("frame", start, "\"bytes\":%d", bytes);
+
+  if (T.keys > 0)
+    {
+      int syscalls = T.syscalls - T.frame_syscalls;
+      long long since = T.input_since ? T.input_since : start;
+      T.stats.key_latency_us = trace_span (
+          "keys", since, "\"keys\":%d,\"syscalls\":%d", T.keys, syscalls);
+      T.stats.key_syscalls = (syscalls + T.keys - 1) / T.keys;
+    }
+
+  T.keys = 0;
+  T.input_since = 0;
+  T.frame_syscalls = T.syscalls;
+}
+
+const struct trace_stats *
+trace_get_stats ()
+{
+  return &T.stats;
+}
@@ -0,0 +1,54 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+
+// Where the time of the editor goes. Spans of work are timed and, while a
+// trace file is open, written to it as Chrome trace events (JSON array
+// format, for chrome://tracing or Perfetto). The latest timings and
+// counters are kept for the performance overlay of the status bar.
+
+struct trace_stats
+{
+  // Microseconds from reading the keys of a frame to writing it, and
+  // spent composing and writing the last frame.
+  long long key_latency_us;
+  long long refresh_us;
+  // System calls made per key for the last frame that followed keys,
+  // counted where the editor makes them.
+  int key_syscalls;
+};
+
+// Write trace events to FILE_NAME from now on, until exit. False with errno
+// set if it can't be created.
+bool trace_open (const char *file_name);
+
+// Whether trace events are written.
+bool trace_active ();
+
+// Microseconds on CLOCK_MONOTONIC.
+long long trace_now_us ();
+
+// Record the span of work NAME that started at START and return how long
+// it took. FMT and what follows print the body of its JSON "args" object,
+// NULL for none.
+long long trace_span (const char *name, long long start, const char *fmt,
+                      ...) __attribute__ ((format (printf, 3, 4)));
+
+// Record the values of counter NAME, printed as by trace_span ().
+void trace_counter (const char *name, const char *fmt, ...)
+    __attribute__ ((format (printf, 2, 3)));
+
+// Count a system call made by the editor.
+void trace_syscall ();
+
+// Keys arrived, and one of them was handled.
+void trace_input ();
+void trace_key ();
+
+// The frame that started at START was written out.
+void trace_frame (long long start, int bytes);
+
+const struct trace_stats *trace_get_stats ();
+
+#endif
@@ -0,0 +1,253 @@
+#include "undo.h"
+#include "columns.h"
+#include "terminal.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/***************** helpers ************************/
+
+static size_t
+entry_bytes (const struct undo_entry *entry)
+{
+  return sizeof (struct undo_entry) + entry->cap;
+}
+
+static void
+entry_free (struct undo_entry *entry)
+{
+  free (entry->text);
+  free (entry);
+}
+
+static void
+entry_append (struct undo_journal *journal, struct undo_entry *entry,
+              const char *text, int len, bool prepend)
+{
+  if (entry->text == NULL || entry->len + len > entry->cap)
+    {
+      int cap = entry->cap ? entry->cap : 16;
+      while (cap < entry->len + len)
+        cap *= 2;
+
+      char *new = realloc (entry->text, cap);
+      if (new == NULL)
+        die ("realloc");
+
+      journal->bytes += cap - entry->cap;
+      entry->text = new;
+      entry->cap = cap;
+    }
+
+  if (prepend)
+    {
+      memmove (&entry->text[len], entry->text, entry->len);
+      memcpy (entry->text, text, len);
+    }
+  else
+    memcpy (&entry->text[entry->len], text, len);
+  entry->len += len;
+}
+
+static void
+clear_redo (struct undo_journal *journal)
+{
+  while (journal->redo)
+    {
+      struct undo_entry *older = journal->redo->older;
+      journal->bytes -= entry_bytes (journal->redo);
+      entry_free (journal->redo);
+      journal->redo = older;
+    }
+}
+
+// Whether the LEN bytes of TEXT are a single character.
+static bool
+is_char (const char *text, int len)
+{
+  int width;
+  return len > 0 && column_char (text, len, 0, &width) == len;
+}
+
+// Merge a single typed or deleted character into the newest entry.
+static bool
+coalesce (struct undo_journal *journal, enum undo_kind kind, int y, int x,
+          const char *text, int len)
+{
+  struct undo_entry *top = journal->newest;
+
+  if (top == NULL || top->sealed || top->kind != kind || top->y != y
+      || !is_char (text, len) || text[0] == '\n')
+    return false;
+
+  if (kind == UNDO_INSERT && x == top->x + top->len)
+    entry_append (journal, top, text, len, false);
+  // Forward delete keeps X, backspace walks left.
+  else if (kind == UNDO_DELETE && x == top->x)
+    entry_append (journal, top, text, len, false);
+  else if (kind == UNDO_DELETE && x + len == top->x)
+    {
+      entry_append (journal, top, text, len, true);
+      top->x = x;
+    }
+  else
+    return false;
+
+  return true;
+}
+
+// Drop the oldest groups until the journal fits its limit again, the group
+// being recorded is always kept.
+static void
+enforce_limit (struct undo_journal *journal)
+{
+  while (journal->bytes > journal->limit && journal->oldest
+         && journal->oldest->group != journal->group)
+    {
+      struct undo_entry *oldest = journal->oldest;
+      journal->oldest = oldest->newer;
+      if (journal->oldest)
+        journal->oldest->older = NULL;
+      else
+        journal->newest = NULL;
+      journal->bytes -= entry_bytes (oldest);
+      entry_free (oldest);
+    }
+}
+
+/***************** undo journal ************************/
+
+bool
+undo_recording (const struct undo_journal *journal)
+{
+  return journal->suspended == 0;
+}
+
+void
+undo_suspend (struct undo_journal *journal)
+{
+  journal->suspended++;
+}
+
+void
+undo_resume (struct undo_journal *journal)
+{
+  journal->suspended--;
+}
+
+void
+undo_begin_group (struct undo_journal *journal)
+{
+  journal->new_group = true;
+}
+
+void
+undo_break (struct undo_journal *journal)
+{
+  if (journal->newest)
+    journal->newest->sealed = true;
+}
+
+void
+undo_record (struct undo_journal *journal, enum undo_kind kind, int y,
+             int x, const char *text, int len, int cursor_y, int cursor_x)
+{
+  if (!undo_recording (journal))
+    return;
+
+  clear_redo (journal);
+
+  if (coalesce (journal, kind, y, x, text, len))
+    {
+      // The merged character belongs to the step it continues.
+      journal->new_group = false;
+      return;
+    }
+
+  struct undo_entry *entry = calloc (1, sizeof (struct undo_entry));
+  if (entry == NULL)
+    die ("calloc");
+
+  if (journal->new_group)
+    {
+      journal->group++;
+      journal->new_group = false;
+    }
+
+  entry->group = journal->group;
+  entry->kind = kind;
+  entry->y = y;
+  entry->x = x;
+  entry->cursor_y = cursor_y;
+  entry->cursor_x = cursor_x;
+  journal->bytes += entry_bytes (entry);
+  entry_append (journal, entry, text, len, false);
+
+  // Only plain character edits are merged with the ones that follow.
+  entry->sealed = !is_char (text, len) || kind == UNDO_INSERT_ROW
+                  || kind == UNDO_DELETE_ROW;
+
+  entry->older = journal->newest;
+  if (journal->newest)
+    journal->newest->newer = entry;
+  else
+    journal->oldest = entry;
+  journal->newest = entry;
+
+  enforce_limit (journal);
+}
+
+struct undo_entry *
+undo_pop (struct undo_journal *journal, unsigned long group)
+{
+  struct undo_entry *entry = journal->newest;
+  if (entry == NULL || entry->group != group)
+    return NULL;
+
+  journal->newest = entry->older;
+  if (journal->newest)
+    journal->newest->newer = NULL;
+  else
+    journal->oldest = NULL;
+
+  entry->sealed = true;
+  entry->older = journal->redo;
+  entry->newer = NULL;
+  journal->redo = entry;
+  return entry;
+}
+
+struct undo_entry *
+undo_pop_redo (struct undo_journal *journal, unsigned long group)
+{
+  struct undo_entry *entry = journal->redo;
+  if (entry == NULL || entry->group != group)
+    return NULL;
+
+  journal->redo = entry->older;
+
+  entry->older = journal->newest;
+  entry->newer = NULL;
+  if (journal->newest)
+    journal->newest->newer = entry;
+  else
+    journal->oldest = entry;
+  journal->newest = entry;
+  return entry;
+}
+
+// desctructor
+void
+undo_free (struct undo_journal *journal)
+{
+  clear_redo (journal);
+  while (journal->newest)
+    {
+      struct undo_entry *older = journal->newest->older;
+      entry_free (journal->newest);
+      journal->newest = older;
+    }
+  journal->oldest = NULL;
+  journal->bytes = 0;
+  journal->new_group = true;
+}
@@ -0,0 +1,92 @@
+#ifndef UNDO_H
+#define UNDO_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Journal of the edits made to a document, as compact text deltas. Entries
+// made by one command share a group and are undone together, runs of typed
+// or deleted characters are merged into a single entry, and the oldest
+// groups are dropped once the journal outgrows its memory limit.
+
+enum undo_kind
+{
+  // TEXT, which may span lines, was inserted at (Y, X).
+  UNDO_INSERT,
+  // TEXT, which may span lines, was deleted from (Y, X).
+  UNDO_DELETE,
+  // Row Y holding TEXT was inserted.
+  UNDO_INSERT_ROW,
+  // Row Y holding TEXT was deleted.
+  UNDO_DELETE_ROW,
+};
+
+struct undo_entry
+{
+  // Older and newer neighbours on the undo stack, the redo stack only uses
+  // OLDER.
+  struct undo_entry *older;
+  struct undo_entry *newer;
+  unsigned long group;
+  enum undo_kind kind;
+  int y, x;
+  // Cursor position before the edit.
+  int cursor_y, cursor_x;
+  char *text;
+  int len;
+  int cap;
+  // No more characters may be merged into this entry.
+  bool sealed;
+};
+
+struct undo_journal
+{
+  struct undo_entry *oldest;
+  struct undo_entry *newest;
+  struct undo_entry *redo;
+  unsigned long group;
+  bool new_group;
+  // Recording is off while > 0, e.g. while an entry is being undone.
+  int suspended;
+  size_t bytes;
+  size_t limit;
+};
+
+// constructor
+#define UNDO_JOURNAL_INIT(limit)                                              \
+  {                                                                           \
+    NULL, NULL, NULL, 0, true, 0, 0, limit                                    \
+  }
+
+// desctructor
+void undo_free (struct undo_journal *journal);
+
+// Whether edits are being recorded right now.
+bool undo_recording (const struct undo_journal *journal);
+
+// Stop and restart recording, calls nest.
+void undo_suspend (struct undo_journal *journal);
+void undo_resume (struct undo_journal *journal);
+
+// Edits recorded from now on form a new undo step.
+void undo_begin_group (struct undo_journal *journal);
+
+// Stop merging characters into the newest entry, e.g. after the cursor
+// moved.
+void undo_break (struct undo_journal *journal);
+
+// Record an edit made with the cursor at (CURSOR_Y, CURSOR_X).
+void undo_record (struct undo_journal *journal, enum undo_kind kind, int y,
+                  int x, const char *text, int len, int cursor_y,
+                  int cursor_x);
+
+// Take the newest entry off the undo stack onto the redo stack, NULL if
+// there is none. Entries of a group are returned until the group changes.
+struct undo_entry *undo_pop (struct undo_journal *journal,
+                             unsigned long group);
+
+// Move the newest redo entry back onto the undo stack.
+struct undo_entry *undo_pop_redo (struct undo_journal *journal,
+                                  unsigned long group);
+
+#endif
@@ -0,0 +1,342 @@
+// feature test macros
+#define _DEFAULT_SOURCE
+#define _BSD_SOURCE
+#define _GNU_SOURCE
+
+#include "editor.h"
+#include "screen.h"
+#include "terminal.h"
+
+#include <fcntl.h>
+#include <locale.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// Benchmark of the core editing operations on synthetic files. Every
+// operation is timed individually and reported as latency percentiles.
+//
+// Usage: jate_bench [--sizes 1M,16M,128M] [--dir /tmp]
+
+#define EDIT_SAMPLES 1000
+#define RENDER_SAMPLES 200
+
+struct samples
+{
+  double *us;
+  int count;
+  int cap;
+};
+
+static unsigned int seed = 12345;
+
+static unsigned int
+bench_rand ()
+{
+  seed = seed * 1103515245 + 12345;
+  return seed >> 8;
+}
+
+static double
+now_us ()
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void
+samples_add (struct samples *s, double us)
+{
+  if (s->count == s->cap)
+    {
+      s->cap = s->cap ? s->cap * 2 : 64;
+      s->us = realloc (s->us, sizeof (double) * s->cap);
+      if (s->us == NULL)
+        die ("realloc");
+    }
+  s->us[s->count++] = us;
+}
+
+static int
+compare_double (const void *a, const void *b)
+{
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+static double
+percentile (const struct samples *s, double p)
+{
+  int i = (int)(p / 100.0 * (s->count - 1) + 0.5);
+  return s->us[i];
+}
+
+static void
+report (const char *size, const char *op, struct samples *s)
+{
+  if (s->count == 0)
+    return;
+
+  qsort (s->us, s->count, sizeof (double), compare_double);
+  printf ("%-6s %-8s %7d %12.1f %12.1f %12.1f %12.1f\n", size, op, s->count,
+          percentile (s, 50), percentile (s, 90), percentile (s, 99),
+          s->us[s->count - 1]);
+  s->count = 0;
+}
+
+static long long
+parse_size (const char *text)
+{
+  char *end;
+  long long size = strtoll (text, &end, 10);
+  switch (*end)
+    {
+    case 'G':
+    case 'g':
+      size <<= 10;
+      // fall through
+    case 'M':
+    case 'm':
+      size <<= 10;
+      // fall through
+    case 'K':
+    case 'k':
+      size <<= 10;
+    }
+  return size;
+}
+
+// Write a file of SIZE bytes of text lines, some of them indented by tabs,
+// unless it already exists.
+static void
+generate_file (const char *path, long long size)
+{
+  struct stat st;
+  if (stat (path, &st) == 0 && st.st_size == size)
+    return;
+
+  FILE *fp = fopen (path, "w");
+  if (fp == NULL)
+    die ("fopen");
+
+  static const char words[] = "lorem ipsum dolor sit amet consectetur "
+                              "adipiscing elit sed do eiusmod tempor ";
+  long long written = 0;
+  while (written < size)
+    {
+      int length = bench_rand () % 100;
+      if (written + length + 1 > size)
+        length = size - written - 1;
+
+      int i = 0;
+      if (length > 0 && bench_rand () % 10 == 0)
+        {
+          fputc ('\t', fp);
+          i++;
+        }
+      for (; i < length; i++)
+        fputc (words[(written + i) % (sizeof (words) - 1)], fp);
+      fputc ('\n', fp);
+      written += length + 1;
+    }
+
+  fclose (fp);
+}
+
+// Place the cursor on a random position in the document.
+static void
+random_cursor ()
+{
+  E.buf->cursor_y = bench_rand () % E.buf->num_rows;
+  e_row *row = row_tree_at (&E.buf->rows, E.buf->cursor_y);
+  E.buf->cursor_x = bench_rand () % (row->size + 1);
+}
+
+// Time searching, editing and saving the open document, whose samples go
+// to S and which gets saved to SAVED.
+static void
+bench_edit (const char *label, const char *saved, int repeats,
+            struct samples *s)
+{
+  double start;
+
+  // Next match of a pattern found on most lines, then full scans for one
+  // that is not there at all.
+  static const char common[] = "dolor sit";
+  static const char missing[] = "not in the file";
+  search_set_pattern (&E.buf->search, common, sizeof (common) - 1);
+  for (int i = 0; i < EDIT_SAMPLES; i++)
+    {
+      random_cursor ();
+      start = now_us ();
+      search_next (&E.buf->search, &E.buf->rows, E.buf->cursor_y,
+                   E.buf->cursor_x + 1, false);
+      samples_add (s, now_us () - start);
+    }
+  report (label, "find", s);
+
+  search_set_pattern (&E.buf->search, missing, sizeof (missing) - 1);
+  for (int i = 0; i < repeats; i++)
+    {
+      search_reset (&E.buf->search);
+      start = now_us ();
+      search_next (&E.buf->search, &E.buf->rows, 0, 0, false);
+      samples_add (s, now_us () - start);
+    }
+  report (label, "scan", s);
+
+  for (int i = 0; i < EDIT_SAMPLES; i++)
+    {
+      random_cursor ();
+      start = now_us ();
+      editor_insert_char ('x');
+      samples_add (s, now_us () - start);
+    }
+  report (label, "insert", s);
+
+  for (int i = 0; i < EDIT_SAMPLES; i++)
+    {
+      random_cursor ();
+      start = now_us ();
+      editor_insert_newline ();
+      samples_add (s, now_us () - start);
+    }
+  report (label, "newline", s);
+
+  for (int i = 0; i < EDIT_SAMPLES; i++)
+    {
+      random_cursor ();
+      if (E.buf->cursor_y == 0 && E.buf->cursor_x == 0)
+        E.buf->cursor_y = 1;
+      start = now_us ();
+      editor_delete_char ();
+      samples_add (s, now_us () - start);
+    }
+  report (label, "delete", s);
+
+  // The whole document rewritten, then a line appended to it and only that
+  // written out.
+  free (E.buf->filename);
+  E.buf->filename = strdup (saved);
+  for (int i = 0; i < repeats; i++)
+    {
+      E.buf->save_from = 0;
+      start = now_us ();
+      if (!editor_save ())
+        die ("editor_save");
+      samples_add (s, now_us () - start);
+    }
+  report (label, "save", s);
+
+  for (int i = 0; i < repeats; i++)
+    {
+      editor_append_row ("appended line", 13);
+      start = now_us ();
+      if (!editor_save ())
+        die ("editor_save");
+      samples_add (s, now_us () - start);
+    }
+  report (label, "append", s);
+}
+
+static void
+bench_size (const char *label, long long size, const char *dir)
+{
+  char path[4096], saved[sizeof (path) + 6];
+  snprintf (path, sizeof (path), "%s/jate-bench-%s.txt", dir, label);
+  snprintf (saved, sizeof (saved), "%s.saved", path);
+  generate_file (path, size);
+
+  struct samples s = { NULL, 0, 0 };
+  int repeats = size >= (64 << 20) ? 3 : 10;
+  double start;
+
+  // Time to the first screen of the file, then until all of it is loaded.
+  struct samples loaded = { NULL, 0, 0 };
+  for (int i = 0; i < repeats; i++)
+    {
+      editor_close ();
+      start = now_us ();
+      editor_open (path);
+      editor_refresh_screen ();
+      samples_add (&s, now_us () - start);
+      editor_load_wait ();
+      samples_add (&loaded, now_us () - start);
+    }
+  report (label, "open", &s);
+  report (label, "load", &loaded);
+  free (loaded.us);
+
+  for (int i = 0; i < RENDER_SAMPLES; i++)
+    {
+      random_cursor ();
+      start = now_us ();
+      editor_refresh_screen ();
+      samples_add (&s, now_us () - start);
+    }
+  report (label, "render", &s);
+
+  // Files viewed read-only a window at a time can't be edited or saved,
+  // and searching them would only cover the window.
+  if (E.buf->view.active)
+    printf ("%-6s view-only, not searched, edited or saved\n", label);
+  else
+    bench_edit (label, saved, repeats, &s);
+
+  editor_close ();
+  unlink (saved);
+  free (s.us);
+}
+
+int
+main (int argc, char *argv[])
+{
+  const char *sizes = "1M,16M,128M";
+  const char *dir = "/tmp";
+
+  setlocale (LC_CTYPE, "");
+
+  for (int i = 1; i < argc; i++)
+    {
+      if (strcmp (argv[i], "--sizes") == 0 && i + 1 < argc)
+        sizes = argv[++i];
+      else if (strcmp (argv[i], "--dir") == 0 && i + 1 < argc)
+        dir = argv[++i];
+      else
+        {
+          fprintf (stderr, "Usage: %s [--sizes 1M,16M,128M] [--dir DIR]\n",
+                   argv[0]);
+          return 2;
+        }
+    }
+
+  int devnull = open ("/dev/null", O_WRONLY);
+  if (devnull == -1)
+    die ("open");
+
+  init_editor ();
+  screen_set_output (devnull);
+  editor_set_screen_size (24, 80);
+
+  printf ("%-6s %-8s %7s %12s %12s %12s %12s\n", "size", "op", "samples",
+          "p50 (us)", "p90 (us)", "p99 (us)", "max (us)");
+
+  char *list = strdup (sizes);
+  for (char *label = strtok (list, ","); label; label = strtok (NULL, ","))
+    {
+      long long size = parse_size (label);
+      if (size <= 0)
+        {
+          fprintf (stderr, "invalid size: %s\n", label);
+          return 2;
+        }
+      bench_size (label, size, dir);
+    }
+
+  free (list);
+  return 0;
+}
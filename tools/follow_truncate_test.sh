@@ -0,0 +1,40 @@
+#!/bin/sh
+# Truncates a followed file under the headless editor, as copytruncate log
+# rotation does, while the buffer has unsaved changes. The editor must not
+# crash on the rows that pointed past the new end, and a save must still
+# write the change.
+#
+# Usage: follow_truncate_test.sh JATE_HEADLESS
+
+headless=$1
+file=$(mktemp)
+trap 'rm -f "$file"' EXIT
+seq 1 20000 > "$file"
+
+# Ctrl-W follows the file and goes to its last line, which is then edited.
+# Once the file is cut short, arrows up redraw the lines above and Ctrl-S
+# saves. Pauses let the editor take in each step.
+{
+  printf '\027'
+  sleep 0.3
+  printf 'X'
+  sleep 0.3
+  : > "$file"
+  sleep 0.3
+  printf '\033[A\033[A'
+  sleep 0.3
+  printf '\023'
+  sleep 0.3
+  printf '\021\021\021'
+} | "$headless" --size 10x40 "$file"
+
+status=$?
+if [ $status -ne 0 ]; then
+  echo "editor exited with status $status"
+  exit 1
+fi
+
+if ! tail -n 1 "$file" | grep -q '^X20000$'; then
+  echo "unsaved change was lost"
+  exit 1
+fi
@@ -0,0 +1,119 @@
+// feature test macros
+#define _DEFAULT_SOURCE
+#define _BSD_SOURCE
+#define _GNU_SOURCE
+
+#include "editor.h"
+#include "screen.h"
+#include "terminal.h"
+#include "trace.h"
+
+#include <fcntl.h>
+#include <locale.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Headless driver: runs the editor on a virtual screen without a terminal.
+// Keystrokes are replayed from a script file holding the raw bytes a
+// terminal would send (e.g. "\x1b[B" for arrow down, "\x13" for Ctrl-S)
+// and frames are written to a sink instead of stdout.
+
+static void
+usage (const char *name)
+{
+  fprintf (stderr,
+           "Usage: %s [--size ROWSxCOLS] [--keys SCRIPT] [--frames OUT] "
+           "[--trace OUT] [FILE...]\n"
+           "  --size    virtual screen size, 24x80 by default\n"
+           "  --keys    keystroke script, stdin by default\n"
+           "  --frames  where frames are written, /dev/null by default\n"
+           "  --trace   where trace events are written, none by default\n",
+           name);
+  exit (2);
+}
+
+int
+main (int argc, char *argv[])
+{
+  int rows = 24, cols = 80;
+  const char *keys = NULL;
+  const char *frames = "/dev/null";
+  // Files are opened in buffers of their own, as by the editor.
+  const char **files = calloc (argc, sizeof (char *));
+  int num_files = 0;
+
+  setlocale (LC_CTYPE, "");
+
+  for (int i = 1; i < argc; i++)
+    {
+      if (strcmp (argv[i], "--size") == 0 && i + 1 < argc)
+        {
+          if (sscanf (argv[++i], "%dx%d", &rows, &cols) != 2 || rows < 3
+              || cols < 1)
+            usage (argv[0]);
+        }
+      else if (strcmp (argv[i], "--keys") == 0 && i + 1 < argc)
+        keys = argv[++i];
+      else if (strcmp (argv[i], "--frames") == 0 && i + 1 < argc)
+        frames = argv[++i];
+      else if (strcmp (argv[i], "--trace") == 0 && i + 1 < argc)
+        {
+          if (!trace_open (argv[++i]))
+            die ("trace_open");
+        }
+      else if (argv[i][0] == '-')
+        usage (argv[0]);
+      else
+        files[num_files++] = argv[i];
+    }
+
+  int input = keys ? open (keys, O_RDONLY) : STDIN_FILENO;
+  if (input == -1)
+    die ("open");
+
+  int output = open (frames, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (output == -1)
+    die ("open");
+
+  init_editor ();
+  editor_set_input (input);
+  screen_set_output (output);
+  editor_set_screen_size (rows, cols);
+  for (int i = 0; i < num_files; i++)
+    {
+      if (i > 0)
+        editor_new_buffer ();
+      editor_open (files[i]);
+    }
+  editor_switch_buffer (0);
+  free (files);
+
+  unsigned long keys_processed = 0;
+  while (true)
+    {
+      // Same pacing as the interactive loop, one frame per input batch.
+      if (!editor_input_pending ())
+        {
+          // Background work is done before each batch so that runs can be
+          // reproduced.
+          editor_load_wait ();
+          while (editor_background_step ())
+            ;
+
+          editor_refresh_screen ();
+          if (!editor_input_wait (-1))
+            break;
+        }
+
+      editor_process_keypress ();
+      keys_processed++;
+    }
+
+  const struct screen_stats *stats = screen_get_stats ();
+  fprintf (stderr, "%lu keys, %lu frames, %lu bytes written\n",
+           keys_processed, stats->frames, stats->total_bytes);
+
+  return 0;
+}